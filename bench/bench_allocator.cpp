@@ -0,0 +1,139 @@
+// luaalloc_pool against luaalloc_default: a Lua script churning through decoded frames,
+// then the allocators called directly from several threads at once, the blocks of each
+// thread freed by its neighbour as io threads free what the script allocated.
+//
+// usage: bench_allocator [frames] [threads] [blocks per thread]
+// numbers mean little unless configured with -DCMAKE_BUILD_TYPE=Release.
+
+#include "../src/lua_allocator.h"
+#include <boost/thread/thread.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace {
+
+	typedef std::chrono::steady_clock bench_clock;
+
+	struct backend {
+		const char* name;
+		lua_Alloc alloc;
+	};
+
+	const backend backends[] = {
+		{ "default", luaalloc_default },
+		{ "pool", luaalloc_pool },
+	};
+
+	// what a handler does with a frame: a table of fields, a few strings, a reply built.
+	const char* frame_script =
+		"local frames = ...\n"
+		"local kept = {}\n"
+		"for i = 1, frames do\n"
+		"  local msg = { id = i, cmd = 'move', args = { i % 7, i % 13, 'p' .. (i % 100) } }\n"
+		"  local reply = { id = msg.id, ok = true, text = msg.cmd .. ':' .. msg.args[3] }\n"
+		"  kept[i % 512] = reply\n"
+		"end\n"
+		"return #kept\n";
+
+	double run_frames(lua_Alloc alloc, lua_Integer frames, size_t* peak)
+	{
+		lua_State* L = luaalloc_newstate(alloc, 0);
+		luaL_openlibs(L);
+
+		bench_clock::time_point start = bench_clock::now();
+		if (luaL_loadstring(L, frame_script) != LUA_OK) {
+			std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+			std::exit(1);
+		}
+		lua_pushinteger(L, frames);
+		if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+			std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+			std::exit(1);
+		}
+		lua_gc(L, LUA_GCCOLLECT, 0);
+		double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+		*peak = luaalloc_state(L)->peak;
+		luaalloc_close(L);
+		return seconds;
+	}
+
+	struct block {
+		void* ptr;
+		size_t size;
+	};
+
+	const size_t churn_rounds = 20;
+
+	// replaces every block in slots, round after round, with one of another size.
+	void churn(lua_Alloc alloc, std::vector<block>* slots, unsigned seed)
+	{
+		for (size_t r = 0; r < churn_rounds; r++) {
+			for (size_t i = 0; i < slots->size(); i++) {
+				block& b = (*slots)[i];
+				if (b.ptr != NULL) {
+					alloc(NULL, b.ptr, b.size, 0);
+				}
+				seed = seed * 1103515245 + 12345;
+				b.size = 1 + (seed >> 16) % LUAALLOC_MAX_SMALL;
+				b.ptr = alloc(NULL, NULL, 0, b.size);
+			}
+		}
+	}
+
+	double run_threads(lua_Alloc alloc, size_t threads, size_t blocks)
+	{
+		block empty = { NULL, 0 };
+		std::vector<std::vector<block> > slots(threads, std::vector<block>(blocks, empty));
+
+		bench_clock::time_point start = bench_clock::now();
+		for (size_t pass = 0; pass < 2; pass++) {
+			boost::thread_group group;
+			for (size_t t = 0; t < threads; t++) {
+				// on the second pass each thread takes over its neighbour's slots.
+				std::vector<block>* mine = &slots[(t + pass) % threads];
+				unsigned seed = (unsigned)(t * 2 + pass);
+				group.create_thread([alloc, mine, seed]() { churn(alloc, mine, seed); });
+			}
+			group.join_all();
+		}
+		double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+		for (size_t t = 0; t < threads; t++) {
+			for (size_t i = 0; i < blocks; i++) {
+				block& b = slots[t][i];
+				if (b.ptr != NULL) {
+					alloc(NULL, b.ptr, b.size, 0);
+				}
+			}
+		}
+		return seconds;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	lua_Integer frames = argc > 1 ? std::strtoll(argv[1], NULL, 10) : 1000000;
+	size_t threads = argc > 2 ? std::strtoul(argv[2], NULL, 10) : 4;
+	size_t blocks = argc > 3 ? std::strtoul(argv[3], NULL, 10) : 100000;
+
+	std::printf("allocator  frames     seconds  frames/s    peak bytes\n");
+	for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		size_t peak = 0;
+		double seconds = run_frames(backends[i].alloc, frames, &peak);
+		std::printf("%-10s %-10lld %7.3f  %-10.0f %zu\n",
+			backends[i].name, (long long)frames, seconds, frames / seconds, peak);
+	}
+
+	std::printf("\nallocator  threads  operations  seconds  operations/s\n");
+	for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+		double seconds = run_threads(backends[i].alloc, threads, blocks);
+		// an allocation and a free per block, per round, per pass.
+		size_t operations = 2 * churn_rounds * threads * blocks * 2;
+		std::printf("%-10s %7zu %11zu %8.3f  %.0f\n",
+			backends[i].name, threads, operations, seconds, operations / seconds);
+	}
+	return 0;
+}
@@ -0,0 +1,185 @@
+// net.codec's jsonEncode/jsonDecode against a JSON module written in plain Lua, on
+// messages of the sizes the framed protocol carries: a short command, a reply with a
+// list of records, and a bulk state dump.
+//
+// usage: bench_json [seconds per case]
+// numbers mean little unless configured with -DCMAKE_BUILD_TYPE=Release.
+
+#include "../src/codec/codec_reg.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+	// a compact, typical pure-Lua codec: string.format/gsub for strings, string.find
+	// driven recursive descent for decoding.
+	const char* lua_json =
+		"local json = {}\n"
+		"local escapes = { ['\"'] = '\\\\\"', ['\\\\'] = '\\\\\\\\', ['\\n'] = '\\\\n', ['\\r'] = '\\\\r', ['\\t'] = '\\\\t' }\n"
+		"local function escape(c) return escapes[c] or string.format('\\\\u%04x', c:byte()) end\n"
+		"local encode\n"
+		"local function encode_table(t, out)\n"
+		"  if #t > 0 or next(t) == nil then\n"
+		"    out[#out + 1] = '['\n"
+		"    for i = 1, #t do if i > 1 then out[#out + 1] = ',' end encode(t[i], out) end\n"
+		"    out[#out + 1] = ']'\n"
+		"  else\n"
+		"    out[#out + 1] = '{'\n"
+		"    local first = true\n"
+		"    for k, v in pairs(t) do\n"
+		"      if not first then out[#out + 1] = ',' end\n"
+		"      first = false\n"
+		"      encode(tostring(k), out) out[#out + 1] = ':' encode(v, out)\n"
+		"    end\n"
+		"    out[#out + 1] = '}'\n"
+		"  end\n"
+		"end\n"
+		"encode = function(v, out)\n"
+		"  local t = type(v)\n"
+		"  if t == 'table' then encode_table(v, out)\n"
+		"  elseif t == 'string' then out[#out + 1] = '\"' .. v:gsub('[%c\"\\\\]', escape) .. '\"'\n"
+		"  elseif t == 'number' then out[#out + 1] = math.type(v) == 'integer' and tostring(v) or string.format('%.17g', v)\n"
+		"  elseif t == 'boolean' then out[#out + 1] = tostring(v)\n"
+		"  else out[#out + 1] = 'null' end\n"
+		"end\n"
+		"function json.encode(v) local out = {} encode(v, out) return table.concat(out) end\n"
+		"local decode\n"
+		"local unescapes = { b = '\\b', f = '\\f', n = '\\n', r = '\\r', t = '\\t' }\n"
+		"local function decode_string(s, i)\n"
+		"  local j = i\n"
+		"  local parts\n"
+		"  while true do\n"
+		"    local k = s:find('[\"\\\\]', j)\n"
+		"    if not k then error('unterminated string') end\n"
+		"    if s:byte(k) == 34 then\n"
+		"      if not parts then return s:sub(i, k - 1), k + 1 end\n"
+		"      parts[#parts + 1] = s:sub(j, k - 1)\n"
+		"      return table.concat(parts), k + 1\n"
+		"    end\n"
+		"    parts = parts or {}\n"
+		"    parts[#parts + 1] = s:sub(j, k - 1)\n"
+		"    local c = s:sub(k + 1, k + 1)\n"
+		"    if c == 'u' then parts[#parts + 1] = utf8.char(tonumber(s:sub(k + 2, k + 5), 16)) j = k + 6\n"
+		"    else parts[#parts + 1] = unescapes[c] or c j = k + 2 end\n"
+		"  end\n"
+		"end\n"
+		"local function skip(s, i) return s:find('[^ \\t\\r\\n]', i) or #s + 1 end\n"
+		"decode = function(s, i)\n"
+		"  i = skip(s, i)\n"
+		"  local c = s:byte(i)\n"
+		"  if c == 123 then\n"
+		"    local t = {}\n"
+		"    i = skip(s, i + 1)\n"
+		"    if s:byte(i) == 125 then return t, i + 1 end\n"
+		"    while true do\n"
+		"      local k, v\n"
+		"      k, i = decode_string(s, skip(s, i) + 1)\n"
+		"      i = skip(s, i) + 1\n"
+		"      v, i = decode(s, i)\n"
+		"      t[k] = v\n"
+		"      i = skip(s, i)\n"
+		"      c = s:byte(i)\n"
+		"      if c == 125 then return t, i + 1 end\n"
+		"      i = i + 1\n"
+		"    end\n"
+		"  elseif c == 91 then\n"
+		"    local t = {}\n"
+		"    i = skip(s, i + 1)\n"
+		"    if s:byte(i) == 93 then return t, i + 1 end\n"
+		"    local n = 1\n"
+		"    while true do\n"
+		"      t[n], i = decode(s, i)\n"
+		"      n = n + 1\n"
+		"      i = skip(s, i)\n"
+		"      c = s:byte(i)\n"
+		"      if c == 93 then return t, i + 1 end\n"
+		"      i = i + 1\n"
+		"    end\n"
+		"  elseif c == 34 then return decode_string(s, i + 1)\n"
+		"  elseif s:find('^true', i) then return true, i + 4\n"
+		"  elseif s:find('^false', i) then return false, i + 5\n"
+		"  elseif s:find('^null', i) then return nil, i + 4\n"
+		"  else\n"
+		"    local num = s:match('^-?%d+%.?%d*[eE]?[-+]?%d*', i)\n"
+		"    if not num then error('unexpected character at ' .. i) end\n"
+		"    return math.tointeger(tonumber(num)) or tonumber(num), i + #num\n"
+		"  end\n"
+		"end\n"
+		"function json.decode(s) return (decode(s, 1)) end\n"
+		"return json\n";
+
+	// builds the three messages and times encode and decode with both codecs.
+	const char* bench_script =
+		"local json, seconds = ...\n"
+		"local codec = require('net.codec')\n"
+		"local function record(i)\n"
+		"  return { id = i, name = 'player' .. i, pos = { x = i * 1.5, y = -i, z = 0 },\n"
+		"           tags = { 'a', 'b', 'c' }, alive = i % 2 == 0, note = 'line\\nbreak \"quoted\"' }\n"
+		"end\n"
+		"local records = {}\n"
+		"for i = 1, 8 do records[i] = record(i) end\n"
+		"local dump = {}\n"
+		"for i = 1, 120 do dump[i] = record(i) end\n"
+		"local cases = {\n"
+		"  { 'command', { id = 42, cmd = 'move', args = { 10, 20, 'run' } } },\n"
+		"  { 'reply', { id = 42, ok = true, players = records } },\n"
+		"  { 'state dump', { tick = 123456, players = dump } },\n"
+		"}\n"
+		"local function rate(fn, arg)\n"
+		"  local n, start = 0, os.clock()\n"
+		"  repeat\n"
+		"    for _ = 1, 50 do fn(arg) end\n"
+		"    n = n + 50\n"
+		"  until os.clock() - start >= seconds\n"
+		"  return n / (os.clock() - start)\n"
+		"end\n"
+		"print(string.format('%-11s %6s  %-6s %12s %12s %8s', 'message', 'bytes', 'op', 'lua msg/s', 'native msg/s', 'speedup'))\n"
+		"for _, case in ipairs(cases) do\n"
+		"  local name, value = case[1], case[2]\n"
+		"  local text = codec.jsonEncode(value)\n"
+		"  -- key order follows the tables' hash layout, so only the lengths are compared.\n"
+		"  assert(#json.encode(value) == #text)\n"
+		"  assert(#codec.jsonEncode(json.decode(text)) == #text)\n"
+		"  local lua_enc, native_enc = rate(json.encode, value), rate(codec.jsonEncode, value)\n"
+		"  local lua_dec, native_dec = rate(json.decode, text), rate(codec.jsonDecode, text)\n"
+		"  print(string.format('%-11s %6d  %-6s %12.0f %12.0f %7.1fx', name, #text, 'encode', lua_enc, native_enc, native_enc / lua_enc))\n"
+		"  print(string.format('%-11s %6d  %-6s %12.0f %12.0f %7.1fx', name, #text, 'decode', lua_dec, native_dec, native_dec / lua_dec))\n"
+		"end\n";
+
+	bool run(lua_State* L, const char* chunk, const char* name, int args, int results)
+	{
+		if (luaL_loadbuffer(L, chunk, strlen(chunk), name) != LUA_OK) {
+			std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+			return false;
+		}
+		if (args > 0) {
+			lua_insert(L, -1 - args);
+		}
+		if (lua_pcall(L, args, results, 0) != LUA_OK) {
+			std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+			return false;
+		}
+		return true;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	double seconds = argc > 1 ? std::strtod(argv[1], NULL) : 1.0;
+
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+	register_net_codec(L);
+
+	if (!run(L, lua_json, "json.lua", 0, 1)) {
+		return 1;
+	}
+	lua_pushnumber(L, seconds);
+	if (!run(L, bench_script, "bench_json", 2, 0)) {
+		return 1;
+	}
+
+	lua_close(L);
+	return 0;
+}
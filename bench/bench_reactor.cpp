@@ -0,0 +1,178 @@
+// Echo round trips over many loopback connections on one io_service, to compare the
+// reactor a build uses: epoll by default, io_uring with -DUSE_IO_URING=ON.
+//
+// usage: bench_reactor [connections] [round trips per connection] [frame bytes]
+
+#include "../src/tcp/handler_memory.h"
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/resource.h>
+#include <vector>
+
+using boost::asio::ip::tcp;
+
+namespace {
+
+	typedef std::chrono::steady_clock bench_clock;
+
+	class echo_connection
+	{
+	public:
+		echo_connection(boost::asio::io_service& io, size_t frame_bytes)
+			:m_client(io)
+			,m_server(io)
+			,m_frame(frame_bytes, 'x')
+			,m_echo(frame_bytes)
+			,m_request(frame_bytes)
+			,m_rounds(0)
+		{
+		}
+
+		tcp::socket& client() { return m_client; }
+		tcp::socket& server() { return m_server; }
+
+		void start(size_t rounds, size_t* running)
+		{
+			m_rounds = rounds;
+			m_running = running;
+			start_server_read();
+			start_round();
+		}
+
+	private:
+		void start_round()
+		{
+			boost::asio::async_write(m_client, boost::asio::buffer(m_frame),
+				net::make_custom_alloc_handler(m_client_write,
+					boost::bind(&echo_connection::handle_client_write, this, boost::asio::placeholders::error)));
+			boost::asio::async_read(m_client, boost::asio::buffer(m_echo),
+				net::make_custom_alloc_handler(m_client_read,
+					boost::bind(&echo_connection::handle_client_read, this, boost::asio::placeholders::error)));
+		}
+
+		void handle_client_write(const boost::system::error_code&)
+		{
+		}
+
+		void handle_client_read(const boost::system::error_code& ec)
+		{
+			if (ec || --m_rounds == 0) {
+				(*m_running)--;
+				m_client.close();
+				return;
+			}
+			start_round();
+		}
+
+		void start_server_read()
+		{
+			boost::asio::async_read(m_server, boost::asio::buffer(m_request),
+				net::make_custom_alloc_handler(m_server_read,
+					boost::bind(&echo_connection::handle_server_read, this, boost::asio::placeholders::error)));
+		}
+
+		void handle_server_read(const boost::system::error_code& ec)
+		{
+			if (ec) {
+				m_server.close();
+				return;
+			}
+			boost::asio::async_write(m_server, boost::asio::buffer(m_request),
+				net::make_custom_alloc_handler(m_server_write,
+					boost::bind(&echo_connection::handle_server_write, this, boost::asio::placeholders::error)));
+		}
+
+		void handle_server_write(const boost::system::error_code& ec)
+		{
+			if (!ec) {
+				start_server_read();
+			}
+		}
+
+	private:
+		tcp::socket m_client;
+		tcp::socket m_server;
+
+		net::handler_memory m_client_read;
+		net::handler_memory m_client_write;
+		net::handler_memory m_server_read;
+		net::handler_memory m_server_write;
+
+		std::vector<char> m_frame;
+		std::vector<char> m_echo;
+		std::vector<char> m_request;
+
+		size_t m_rounds;
+		size_t* m_running;
+	};
+
+	const char* reactor_name()
+	{
+#if defined(BOOST_ASIO_HAS_IO_URING) && defined(BOOST_ASIO_DISABLE_EPOLL)
+		return "io_uring";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+		return "epoll";
+#else
+		return "default";
+#endif
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	size_t connections = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1000;
+	size_t rounds = argc > 2 ? std::strtoul(argv[2], NULL, 10) : 100;
+	size_t frame_bytes = argc > 3 ? std::strtoul(argv[3], NULL, 10) : 64;
+
+	// two descriptors per connection.
+	struct rlimit limit;
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+
+	boost::asio::io_service io;
+	tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	acceptor.listen(4096);
+
+	std::vector<echo_connection*> pairs;
+	for (size_t i = 0; i < connections; i++) {
+		echo_connection* pair = new echo_connection(io, frame_bytes);
+		boost::system::error_code ec;
+		pair->client().connect(acceptor.local_endpoint(), ec);
+		if (!ec) {
+			acceptor.accept(pair->server(), ec);
+		}
+		if (ec) {
+			std::fprintf(stderr, "connection %zu: %s\n", i, ec.message().c_str());
+			delete pair;
+			break;
+		}
+		pair->client().set_option(tcp::no_delay(true));
+		pair->server().set_option(tcp::no_delay(true));
+		pairs.push_back(pair);
+	}
+
+	size_t running = pairs.size();
+	bench_clock::time_point start = bench_clock::now();
+	for (size_t i = 0; i < pairs.size(); i++) {
+		pairs[i]->start(rounds, &running);
+	}
+	while (running > 0) {
+		io.run_one();
+	}
+	double seconds = std::chrono::duration<double>(bench_clock::now() - start).count();
+
+	size_t total = pairs.size() * rounds;
+	std::printf("reactor      connections  frame  round trips  seconds  round trips/s\n");
+	std::printf("%-12s %11zu %6zu %12zu %8.3f %14.0f\n",
+		reactor_name(), pairs.size(), frame_bytes, total, seconds, total / seconds);
+
+	for (size_t i = 0; i < pairs.size(); i++) {
+		delete pairs[i];
+	}
+	return 0;
+}
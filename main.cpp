@@ -1,14 +1,21 @@
 #include "lua.hpp"
 #include "src/register_all_tcp_client.h"
+#include "src/lua_script_cache.h"
+#include "src/lua_allocator.h"
 
 #include <iostream>
 
-int main() {
+int main(int argc, char* argv[]) {
+    // usage: boost_asio_lua_binding [script|precompiled chunk] [bytecode cache dir] [memory limit in MiB]
+    const char* script = argc > 1 ? argv[1] : "hello.lua";
+    const char* cache_dir = argc > 2 && argv[2][0] ? argv[2] : NULL;
+    size_t memory_limit = argc > 3 ? strtoul(argv[3], NULL, 10) * 1024 * 1024 : 0;
+
     /* initialize Lua */
     // create new Lua state
 
     lua_State *L;
-    L = luaL_newstate();
+    L = luaalloc_newstate(luaalloc_pool, memory_limit);
 
     /*static const luaL_Reg lualibs[] =
     {
@@ -29,7 +36,7 @@ int main() {
     register_all_tcp_client(L);
 
     // run the Lua script
-    int error = luaL_dofile(L, "hello.lua");
+    int error = luacache_dofile(L, script, cache_dir);
 
     if (error) {
         fprintf(stderr, "%s", lua_tostring(L, -1));
@@ -37,7 +44,7 @@ int main() {
     }
 
     // close the Lua state
-    lua_close(L);
+    luaalloc_close(L);
 
     std::getchar();
 
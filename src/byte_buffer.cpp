@@ -1,5 +1,128 @@
 #include "byte_buffer.h"
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define BYTE_BUFFER_AVX2 1
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BYTE_BUFFER_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+	inline int first_set_bit(uint32_t mask)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return (int)index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	// first byte equal to key in [p, end), or end.
+	const uint8_t* scan_byte(const uint8_t* p, const uint8_t* end, uint8_t key)
+	{
+#ifdef BYTE_BUFFER_AVX2
+		const __m256i k32 = _mm256_set1_epi8((char)key);
+		for (; end - p >= 32; p += 32) {
+			uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), k32));
+			if (mask != 0) {
+				return p + first_set_bit(mask);
+			}
+		}
+#endif
+#ifdef BYTE_BUFFER_SSE2
+		const __m128i k = _mm_set1_epi8((char)key);
+		for (; end - p >= 16; p += 16) {
+			uint32_t mask = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), k));
+			if (mask != 0) {
+				return p + first_set_bit(mask);
+			}
+		}
+#endif
+		for (; p < end; p++) {
+			if (*p == key) {
+				return p;
+			}
+		}
+		return end;
+	}
+
+	// first occurrence of pattern (len >= 2) in [p, end), or end. Candidates must match
+	// the first and the last byte of the pattern, which rejects most positions 16 at a time.
+	const uint8_t* scan_pattern(const uint8_t* p, const uint8_t* end, const uint8_t* pattern, uint32_t len)
+	{
+		if ((uint32_t)(end - p) < len) {
+			return end;
+		}
+		const uint8_t* last = end - len; // last possible start
+
+#ifdef BYTE_BUFFER_SSE2
+		const __m128i first = _mm_set1_epi8((char)pattern[0]);
+		const __m128i tail = _mm_set1_epi8((char)pattern[len - 1]);
+		for (; last - p >= 15; p += 16) {
+			__m128i hit = _mm_and_si128(
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), first),
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + len - 1)), tail));
+			uint32_t mask = (uint32_t)_mm_movemask_epi8(hit);
+			while (mask != 0) {
+				int i = first_set_bit(mask);
+				if (memcmp(p + i + 1, pattern + 1, len - 2) == 0) {
+					return p + i;
+				}
+				mask &= mask - 1;
+			}
+		}
+#endif
+		for (; p <= last; p++) {
+			if (*p == pattern[0] && memcmp(p, pattern, len) == 0) {
+				return p;
+			}
+		}
+		return end;
+	}
+
+	// replace every key in [p, end) with rep, only storing blocks that contain a key.
+	void replace_all(uint8_t* p, uint8_t* end, uint8_t key, uint8_t rep)
+	{
+#ifdef BYTE_BUFFER_AVX2
+		const __m256i k32 = _mm256_set1_epi8((char)key);
+		const __m256i r32 = _mm256_set1_epi8((char)rep);
+		for (; end - p >= 32; p += 32) {
+			__m256i v = _mm256_loadu_si256((const __m256i*)p);
+			__m256i m = _mm256_cmpeq_epi8(v, k32);
+			if (_mm256_movemask_epi8(m) != 0) {
+				_mm256_storeu_si256((__m256i*)p, _mm256_blendv_epi8(v, r32, m));
+			}
+		}
+#endif
+#ifdef BYTE_BUFFER_SSE2
+		const __m128i k = _mm_set1_epi8((char)key);
+		const __m128i r = _mm_set1_epi8((char)rep);
+		for (; end - p >= 16; p += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i*)p);
+			__m128i m = _mm_cmpeq_epi8(v, k);
+			if (_mm_movemask_epi8(m) != 0) {
+				_mm_storeu_si128((__m128i*)p, _mm_or_si128(_mm_andnot_si128(m, v), _mm_and_si128(m, r)));
+			}
+		}
+#endif
+		for (; p < end; p++) {
+			if (*p == key) {
+				*p = rep;
+			}
+		}
+	}
+}
+
 /**
 * byte_buffer constructor
 * Reserves specified size in internal vector
@@ -173,6 +296,31 @@ uint32_t byte_buffer::size() {
 	return buf.size();
 }
 
+// Searching
+
+/**
+* Find Bytes
+* Search the whole buffer (not stopping at zero bytes) for a sequence of bytes
+*
+* @param pattern Bytes to search for
+* @param len Length of pattern. An empty pattern is found at start
+* @param start Index to start from. By default, start is 0
+* @return Index of the first occurrence at or after start, or -1 if there is none
+*/
+int32_t byte_buffer::findBytes(const uint8_t* pattern, uint32_t len, uint32_t start) {
+	uint32_t size = buf.size();
+	if (start > size || len > size - start)
+		return -1;
+	if (len == 0)
+		return (int32_t)start;
+
+	const uint8_t* begin = buf.data() + start;
+	const uint8_t* end = buf.data() + size;
+	const uint8_t* p = (len == 1) ? scan_byte(begin, end, pattern[0]) : scan_pattern(begin, end, pattern, len);
+
+	return (p == end) ? -1 : (int32_t)(p - buf.data());
+}
+
 // Replacement
 
 /**
@@ -186,19 +334,20 @@ uint32_t byte_buffer::size() {
 */
 void byte_buffer::replace(uint8_t key, uint8_t rep, uint32_t start, bool firstOccuranceOnly) {
 	uint32_t len = buf.size();
-	for (uint32_t i = start; i < len; i++) {
-		uint8_t data = read<uint8_t>(i);
-		// Wasn't actually found, bounds of buffer were exceeded
-		if ((key != 0) && (data == 0))
-			break;
-
-		// Key was found in array, perform replacement
-		if (data == key) {
-			buf[i] = rep;
-			if (firstOccuranceOnly)
-				return;
-		}
+	if (start >= len)
+		return;
+
+	uint8_t* begin = buf.data() + start;
+	uint8_t* end = buf.data() + len;
+
+	if (firstOccuranceOnly) {
+		uint8_t* p = (uint8_t*)scan_byte(begin, end, key);
+		if (p != end)
+			*p = rep;
+		return;
 	}
+
+	replace_all(begin, end, key, rep);
 }
 
 // Read Functions
@@ -216,9 +365,15 @@ uint8_t byte_buffer::get(uint32_t index) {
 }
 
 void byte_buffer::getBytes(uint8_t* buf, uint32_t len) {
-	for (uint32_t i = 0; i < len; i++) {
-		buf[i] = read<uint8_t>();
-	}
+	// Whatever lies past the end reads as zeros, the read position moves on regardless
+	uint32_t avail = (rpos < this->buf.size()) ? (uint32_t)this->buf.size() - rpos : 0;
+	uint32_t n = (len < avail) ? len : avail;
+
+	if (n > 0)
+		memcpy(buf, &this->buf[rpos], n);
+	if (n < len)
+		memset(buf + n, 0, len - n);
+	rpos += len;
 }
 
 char byte_buffer::getChar() {
@@ -246,54 +401,96 @@ float byte_buffer::getFloat(uint32_t index) {
 }
 
 uint32_t byte_buffer::getInt() {
-	uint32_t ret = read<uint32_t>();
-	if (!am_big_endian()) {
-		to_network_order<uint32_t>(&ret);
-	}
-	return ret;
+	return big_endian(read<uint32_t>());
 }
 
 uint32_t byte_buffer::getInt(uint32_t index) {
-	uint32_t ret = read<uint32_t>(index);
-	if (!am_big_endian()) {
-		to_network_order<uint32_t>(&ret);
-	}
-	return ret;
+	return big_endian(read<uint32_t>(index));
+}
+
+uint32_t byte_buffer::getIntBE() {
+	return big_endian(read<uint32_t>());
+}
+
+uint32_t byte_buffer::getIntBE(uint32_t index) {
+	return big_endian(read<uint32_t>(index));
+}
+
+uint32_t byte_buffer::getIntLE() {
+	return little_endian(read<uint32_t>());
+}
+
+uint32_t byte_buffer::getIntLE(uint32_t index) {
+	return little_endian(read<uint32_t>(index));
 }
 
 uint64_t byte_buffer::getLong() {
-	uint64_t ret = read<uint64_t>();
-	//std::cout << ret << std::endl;
-	if (!am_big_endian()) {
-		to_network_order<uint64_t>(&ret);
-	}
-	return ret;
+	return big_endian(read<uint64_t>());
 }
 
 uint64_t byte_buffer::getLong(uint32_t index) {
-	uint64_t ret = read<uint64_t>(index);
-	if (!am_big_endian()) {
-		to_network_order<uint64_t>(&ret);
-	}
-	return ret;
+	return big_endian(read<uint64_t>(index));
+}
+
+uint64_t byte_buffer::getLongBE() {
+	return big_endian(read<uint64_t>());
+}
+
+uint64_t byte_buffer::getLongBE(uint32_t index) {
+	return big_endian(read<uint64_t>(index));
+}
+
+uint64_t byte_buffer::getLongLE() {
+	return little_endian(read<uint64_t>());
+}
+
+uint64_t byte_buffer::getLongLE(uint32_t index) {
+	return little_endian(read<uint64_t>(index));
 }
 
 uint16_t byte_buffer::getShort() {
-	uint16_t ret = read<uint16_t>();
-	if (!am_big_endian()) {
-		to_network_order<uint16_t>(&ret);
-	}
-	return ret;
+	return big_endian(read<uint16_t>());
 }
 
 uint16_t byte_buffer::getShort(uint32_t index) {
-	uint16_t ret = read<uint16_t>(index);
-	if (!am_big_endian()) {
-		to_network_order<uint16_t>(&ret);
-	}
-	return ret;
+	return big_endian(read<uint16_t>(index));
+}
+
+uint16_t byte_buffer::getShortBE() {
+	return big_endian(read<uint16_t>());
+}
+
+uint16_t byte_buffer::getShortBE(uint32_t index) {
+	return big_endian(read<uint16_t>(index));
+}
+
+uint16_t byte_buffer::getShortLE() {
+	return little_endian(read<uint16_t>());
+}
+
+uint16_t byte_buffer::getShortLE(uint32_t index) {
+	return little_endian(read<uint16_t>(index));
+}
+
+bool byte_buffer::getShorts(uint16_t* dst, uint32_t n) {
+	return readArrayBE<uint16_t>(dst, n);
 }
 
+bool byte_buffer::getInts(uint32_t* dst, uint32_t n) {
+	return readArrayBE<uint32_t>(dst, n);
+}
+
+bool byte_buffer::getLongs(uint64_t* dst, uint32_t n) {
+	return readArrayBE<uint64_t>(dst, n);
+}
+
+bool byte_buffer::getFloats(float* dst, uint32_t n) {
+	return readArray<float>(dst, n);
+}
+
+bool byte_buffer::getDoubles(double* dst, uint32_t n) {
+	return readArray<double>(dst, n);
+}
 
 // Write Functions
 
@@ -349,77 +546,108 @@ void byte_buffer::putFloat(float value, uint32_t index) {
 }
 
 void byte_buffer::putInt(uint32_t value) {
-	if (!am_big_endian()) {
-		to_network_order<uint32_t>(&value);
-	}
-	append<uint32_t>(value);
+	append<uint32_t>(big_endian(value));
 }
 
 void byte_buffer::putInt(uint32_t value, uint32_t index) {
-	if (!am_big_endian()) {
-		to_network_order<uint32_t>(&value);
-	}
-	insert<uint32_t>(value, index);
+	insert<uint32_t>(big_endian(value), index);
+}
+
+void byte_buffer::putIntBE(uint32_t value) {
+	append<uint32_t>(big_endian(value));
+}
+
+void byte_buffer::putIntBE(uint32_t value, uint32_t index) {
+	insert<uint32_t>(big_endian(value), index);
+}
+
+void byte_buffer::putIntLE(uint32_t value) {
+	append<uint32_t>(little_endian(value));
+}
+
+void byte_buffer::putIntLE(uint32_t value, uint32_t index) {
+	insert<uint32_t>(little_endian(value), index);
 }
 
 void byte_buffer::putLong(uint64_t value) {
-	if (!am_big_endian()) {
-		to_network_order<uint64_t>(&value);
-	}
-	append<uint64_t>(value);
+	append<uint64_t>(big_endian(value));
 }
 
 void byte_buffer::putLong(uint64_t value, uint32_t index) {
-	if (!am_big_endian()) {
-		to_network_order<uint64_t>(&value);
-	}
-	insert<uint64_t>(value, index);
+	insert<uint64_t>(big_endian(value), index);
+}
+
+void byte_buffer::putLongBE(uint64_t value) {
+	append<uint64_t>(big_endian(value));
+}
+
+void byte_buffer::putLongBE(uint64_t value, uint32_t index) {
+	insert<uint64_t>(big_endian(value), index);
+}
+
+void byte_buffer::putLongLE(uint64_t value) {
+	append<uint64_t>(little_endian(value));
+}
+
+void byte_buffer::putLongLE(uint64_t value, uint32_t index) {
+	insert<uint64_t>(little_endian(value), index);
 }
 
 void byte_buffer::putShort(uint16_t value) {
-	if (!am_big_endian()) {
-		to_network_order<uint16_t>(&value);
-	}
-	append<uint16_t>(value);
+	append<uint16_t>(big_endian(value));
 }
 
 void byte_buffer::putShort(uint16_t value, uint32_t index) {
-	if (!am_big_endian()) {
-		to_network_order<uint16_t>(&value);
-	}
-	insert<uint16_t>(value, index);
+	insert<uint16_t>(big_endian(value), index);
 }
 
-bool byte_buffer::am_big_endian()
-{
-	union { long l; char c[sizeof(long)]; } u;
-	u.l = 1;
-	if (u.c[sizeof(long) - 1] == 1)
-	{
-		// Big Endian
-		return 1;
-	}
-	else
-	{
-		// Little Endian
-		return 0;
-	}
+void byte_buffer::putShortBE(uint16_t value) {
+	append<uint16_t>(big_endian(value));
+}
+
+void byte_buffer::putShortBE(uint16_t value, uint32_t index) {
+	insert<uint16_t>(big_endian(value), index);
+}
+
+void byte_buffer::putShortLE(uint16_t value) {
+	append<uint16_t>(little_endian(value));
+}
+
+void byte_buffer::putShortLE(uint16_t value, uint32_t index) {
+	insert<uint16_t>(little_endian(value), index);
 }
 
 
 static const char* hex_flag = "0123456789ABCDEF";
 
+// "XX " for every byte value, padded to a word so each byte is one 4-byte store.
+struct hex_table {
+	uint32_t words[256];
+
+	hex_table() {
+		for (uint32_t c = 0; c < 256; c++) {
+			char s[4] = { hex_flag[c >> 4], hex_flag[c & 0x0F], ' ', ' ' };
+			memcpy(&words[c], s, sizeof(s));
+		}
+	}
+};
+
+static const hex_table hex_words;
+
 std::string byte_buffer::toHex()
 {
-	std::string hex;
 	uint32_t length = buf.size();
 
+	// one spare byte for the overlapping store of the last word.
+	std::string hex(length * 3 + 1, ' ');
+	char* out = &hex[0];
+	const uint8_t* in = buf.data();
+
 	for (uint32_t i = 0; i < length; i++) {
-		uint8_t c = buf[i];
-		hex.push_back(hex_flag[c & 0xF0]);
-		hex.push_back(hex_flag[c & 0x0F]);
-		hex.push_back(' ');
+		memcpy(out + i * 3, &hex_words.words[in[i]], sizeof(uint32_t));
 	}
+
+	hex.resize(length * 3);
 	return hex;
 }
 
@@ -9,11 +9,23 @@
 #include <cstdlib>
 #include <cstdint>
 #include <cstring>
+#include <string>
 #include <vector>
-#include <boost/enable_shared_from_this.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
+
+#if defined(_MSC_VER)
+#include <stdlib.h>
+#endif
+
+// Host byte order, fixed at compile time
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+#define BYTE_BUFFER_BIG_ENDIAN 1
+#else
+#define BYTE_BUFFER_BIG_ENDIAN 0
+#endif
 
 class byte_buffer
-	: public boost::enable_shared_from_this<byte_buffer>
+	: public boost::intrusive_ref_counter<byte_buffer>
 {
 private:
 	uint32_t rpos, wpos;
@@ -27,20 +39,65 @@ private:
 	}
 
 	template <typename T> T read(uint32_t index) const {
-		if (index + sizeof(T) <= buf.size())
-			return *((T*)&buf[index]);
-		return 0;
+		T data = 0;
+		// memcpy, as index is rarely aligned for T; it compiles to a plain load
+		if ((uint64_t)index + sizeof(T) <= buf.size())
+			memcpy(&data, &buf[index], sizeof(T));
+		return data;
+	}
+
+	// Relative read of n values of T in host order, all or nothing
+	template <typename T> bool readArray(T* dst, uint32_t n) {
+		uint64_t len = (uint64_t)n * sizeof(T);
+		if (len == 0)
+			return true;
+		if ((uint64_t)rpos + len > buf.size())
+			return false;
+
+		memcpy(dst, &buf[rpos], (size_t)len);
+		rpos += (uint32_t)len;
+		return true;
+	}
+
+	template <typename T> bool readArrayBE(T* dst, uint32_t n) {
+		if (!readArray<T>(dst, n))
+			return false;
+		for (uint32_t i = 0; i < n; i++)
+			dst[i] = big_endian(dst[i]);
+		return true;
 	}
 
-	void swap(uint8_t *data, int size) {
-		uint8_t c;
-		int i = 0;
+	static uint16_t byte_swap(uint16_t v) {
+#if defined(_MSC_VER)
+		return _byteswap_ushort(v);
+#else
+		return __builtin_bswap16(v);
+#endif
+	}
 
-		for (; i<(size / 2); i++) {
-			c = data[i];
-			data[i] = data[size - 1 - i];
-			data[size - 1 - i] = c;
-		}
+	static uint32_t byte_swap(uint32_t v) {
+#if defined(_MSC_VER)
+		return _byteswap_ulong(v);
+#else
+		return __builtin_bswap32(v);
+#endif
+	}
+
+	static uint64_t byte_swap(uint64_t v) {
+#if defined(_MSC_VER)
+		return _byteswap_uint64(v);
+#else
+		return __builtin_bswap64(v);
+#endif
+	}
+
+	// Convert between host order and big/little endian (the same swap both ways)
+	template <typename T> static T big_endian(T v) {
+		return BYTE_BUFFER_BIG_ENDIAN ? v : byte_swap(v);
+	}
+
+	template <typename T> static T little_endian(T v) {
+		return BYTE_BUFFER_BIG_ENDIAN ? byte_swap(v) : v;
 	}
 
 	template <typename T> void append(T data) {
@@ -79,36 +136,23 @@ public:
 	uint32_t size(); // Size of internal vector
 	byte_buffer* copy(); //copy the remaining data to new Buffer
 
-						// Basic Searching (Linear)
+						// Searching (vectorized where SSE2/AVX2 is available)
 	template <typename T> int32_t find(T key, uint32_t start = 0) {
-		int32_t ret = -1;
-		uint32_t len = buf.size();
-		for (uint32_t i = start; i < len; i++) {
-			T data = read<T>(i);
-			// Wasn't actually found, bounds of buffer were exceeded
-			if ((key != 0) && (data == 0))
-				break;
-
-			// Key was found in array
-			if (data == key) {
-				ret = (int32_t)i;
-				break;
-			}
-		}
-		return ret;
+		return findBytes((const uint8_t*)&key, sizeof(T), start); // key in host byte order, at any offset
 	}
+	int32_t findBytes(const uint8_t* pattern, uint32_t len, uint32_t start = 0); // Index of the first occurrence of pattern, or -1
 
 	template <typename T> void to_network_order(T* data) {
-		if (!am_big_endian()) {
-			swap((uint8_t*)data, sizeof(T));
-		}
+		*data = big_endian(*data);
 	}
 
 	// Replacement
 	void replace(uint8_t key, uint8_t rep, uint32_t start = 0, bool firstOccuranceOnly = false);
 
 
-	static bool am_big_endian();
+	static bool am_big_endian() {
+		return BYTE_BUFFER_BIG_ENDIAN != 0;
+	}
 
 	// Read
 
@@ -122,12 +166,32 @@ public:
 	double getDouble(uint32_t index);
 	float getFloat();
 	float getFloat(uint32_t index);
-	uint32_t getInt();
+	uint32_t getInt(); // Integers are big endian (network order) unless suffixed LE
 	uint32_t getInt(uint32_t index);
 	uint64_t getLong();
 	uint64_t getLong(uint32_t index);
 	uint16_t getShort();
 	uint16_t getShort(uint32_t index);
+	uint32_t getIntBE();
+	uint32_t getIntBE(uint32_t index);
+	uint64_t getLongBE();
+	uint64_t getLongBE(uint32_t index);
+	uint16_t getShortBE();
+	uint16_t getShortBE(uint32_t index);
+	uint32_t getIntLE();
+	uint32_t getIntLE(uint32_t index);
+	uint64_t getLongLE();
+	uint64_t getLongLE(uint32_t index);
+	uint16_t getShortLE();
+	uint16_t getShortLE(uint32_t index);
+
+	// Batch reads of n fields from the read position with one bounds check. They return
+	// false and leave the read position alone if fewer than n fields remain.
+	bool getShorts(uint16_t* dst, uint32_t n); // Big endian, like getShort
+	bool getInts(uint32_t* dst, uint32_t n);
+	bool getLongs(uint64_t* dst, uint32_t n);
+	bool getFloats(float* dst, uint32_t n); // Host order, like getFloat
+	bool getDoubles(double* dst, uint32_t n);
 
 	// Write
 
@@ -142,12 +206,24 @@ public:
 	void putDouble(double value, uint32_t index);
 	void putFloat(float value);
 	void putFloat(float value, uint32_t index);
-	void putInt(uint32_t value);
+	void putInt(uint32_t value); // Integers are big endian (network order) unless suffixed LE
 	void putInt(uint32_t value, uint32_t index);
 	void putLong(uint64_t value);
 	void putLong(uint64_t value, uint32_t index);
 	void putShort(uint16_t value);
 	void putShort(uint16_t value, uint32_t index);
+	void putIntBE(uint32_t value);
+	void putIntBE(uint32_t value, uint32_t index);
+	void putLongBE(uint64_t value);
+	void putLongBE(uint64_t value, uint32_t index);
+	void putShortBE(uint16_t value);
+	void putShortBE(uint16_t value, uint32_t index);
+	void putIntLE(uint32_t value);
+	void putIntLE(uint32_t value, uint32_t index);
+	void putLongLE(uint64_t value);
+	void putLongLE(uint64_t value, uint32_t index);
+	void putShortLE(uint16_t value);
+	void putShortLE(uint16_t value, uint32_t index);
 
 	// Buffer Position Accessors & Mutators
 
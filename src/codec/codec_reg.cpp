@@ -0,0 +1,107 @@
+#include "codec_reg.h"
+#include "msgpack_codec.h"
+#include "json_codec.h"
+
+using namespace net;
+
+static const char* packageName = "net.codec";
+
+// Lua raises errors with longjmp, which skips destructors, so the encode buffer and
+// the error message live per thread rather than on the frames below.
+struct codec_scratch {
+	byte_buffer out;
+	std::string error;
+
+	codec_scratch() : out(256) {}
+};
+
+static codec_scratch& scratch()
+{
+	static thread_local codec_scratch s;
+	s.out.clear();
+	s.error.clear();
+	return s;
+}
+
+static int net_codec_encode(lua_State* L)
+{
+	luaL_checkany(L, 1);
+
+	codec_scratch& s = scratch();
+	if (!msgpack_codec::encode(L, 1, s.out, s.error)) {
+		return luaL_error(L, "encode failed: %s", s.error.c_str());
+	}
+
+	lua_pushlstring(L, (const char*)s.out.data(), s.out.size());
+	return 1;
+}
+
+// decode(str [, pos]) returns the value and the position following it.
+static int net_codec_decode(lua_State* L)
+{
+	size_t len = 0;
+	const char* data = luaL_checklstring(L, 1, &len);
+	lua_Integer pos = luaL_optinteger(L, 2, 1);
+	luaL_argcheck(L, pos >= 1 && (size_t)pos <= len, 2, "position out of range");
+
+	codec_scratch& s = scratch();
+	uint32_t used = msgpack_codec::decode(L, (const uint8_t*)data + pos - 1, (uint32_t)(len - pos + 1), s.error);
+	if (used == 0) {
+		return luaL_error(L, "decode failed: %s", s.error.c_str());
+	}
+
+	lua_pushinteger(L, pos + used);
+	return 2;
+}
+
+static int net_codec_jsonEncode(lua_State* L)
+{
+	luaL_checkany(L, 1);
+
+	codec_scratch& s = scratch();
+	if (!json_codec::encode(L, 1, s.out, s.error)) {
+		return luaL_error(L, "jsonEncode failed: %s", s.error.c_str());
+	}
+
+	lua_pushlstring(L, (const char*)s.out.data(), s.out.size());
+	return 1;
+}
+
+static int net_codec_jsonDecode(lua_State* L)
+{
+	size_t len = 0;
+	const char* data = luaL_checklstring(L, 1, &len);
+
+	codec_scratch& s = scratch();
+	if (!json_codec::decode(L, (const uint8_t*)data, (uint32_t)len, s.error)) {
+		return luaL_error(L, "jsonDecode failed: %s", s.error.c_str());
+	}
+	return 1;
+}
+
+static const luaL_Reg codec_lib_f[] = {
+	{ "encode", net_codec_encode },
+	{ "decode", net_codec_decode },
+	{ "jsonEncode", net_codec_jsonEncode },
+	{ "jsonDecode", net_codec_jsonDecode },
+	{ NULL, NULL },
+};
+
+int luaopen_net_codec(lua_State* L)
+{
+	luaL_newlib(L, codec_lib_f);
+	return 1;
+}
+
+int register_net_codec(lua_State* L)
+{
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "preload");
+
+	lua_pushcfunction(L, luaopen_net_codec);
+	lua_setfield(L, -2, packageName);
+
+	lua_pop(L, 2);
+
+	return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef __CODEC_REG_H__
+#define __CODEC_REG_H__
+
+#include "lua.hpp"
+
+extern int register_net_codec(lua_State* L);
+
+#endif // !__CODEC_REG_H__
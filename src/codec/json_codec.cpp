@@ -0,0 +1,573 @@
+#include "json_codec.h"
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JSON_CODEC_SSE2 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace net {
+
+	namespace {
+
+		inline int first_set_bit(int mask)
+		{
+#if defined(_MSC_VER)
+			unsigned long index;
+			_BitScanForward(&index, (unsigned long)mask);
+			return (int)index;
+#else
+			return __builtin_ctz((unsigned int)mask);
+#endif
+		}
+
+		// first byte in [p, end) that must be escaped in a string: where writing one stops
+		// to escape it, and where reading one stops for the closing quote, an escape or an
+		// invalid raw control character.
+		inline const uint8_t* find_escape(const uint8_t* p, const uint8_t* end)
+		{
+#ifdef JSON_CODEC_SSE2
+			const __m128i quote = _mm_set1_epi8('"');
+			const __m128i backslash = _mm_set1_epi8('\\');
+			const __m128i control = _mm_set1_epi8(0x1f);
+			for (; end - p >= 16; p += 16) {
+				__m128i v = _mm_loadu_si128((const __m128i*)p);
+				__m128i hit = _mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+					_mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+				int mask = _mm_movemask_epi8(hit);
+				if (mask != 0) {
+					return p + first_set_bit(mask);
+				}
+			}
+#endif
+			for (; p < end; p++) {
+				if (*p == '"' || *p == '\\' || *p < 0x20) {
+					return p;
+				}
+			}
+			return end;
+		}
+
+		void put_literal(byte_buffer& out, const char* s)
+		{
+			out.putBytes((const uint8_t*)s, (uint32_t)strlen(s));
+		}
+
+		void put_string(byte_buffer& out, const char* s, size_t len)
+		{
+			static const char* hex = "0123456789abcdef";
+
+			const uint8_t* p = (const uint8_t*)s;
+			const uint8_t* end = p + len;
+
+			out.put('"');
+			while (p < end) {
+				const uint8_t* stop = find_escape(p, end);
+				if (stop != p) {
+					out.putBytes(p, (uint32_t)(stop - p));
+					p = stop;
+					continue;
+				}
+
+				uint8_t c = *p++;
+				out.put('\\');
+				switch (c) {
+				case '"': out.put('"'); break;
+				case '\\': out.put('\\'); break;
+				case '\n': out.put('n'); break;
+				case '\r': out.put('r'); break;
+				case '\t': out.put('t'); break;
+				case '\b': out.put('b'); break;
+				case '\f': out.put('f'); break;
+				default:
+					out.put('u');
+					out.put('0');
+					out.put('0');
+					out.put(hex[c >> 4]);
+					out.put(hex[c & 0x0f]);
+					break;
+				}
+			}
+			out.put('"');
+		}
+
+		bool put_number(lua_State* L, int index, byte_buffer& out, std::string& error)
+		{
+			char num[64];
+			int n;
+			if (lua_isinteger(L, index)) {
+				n = snprintf(num, sizeof(num), LUA_INTEGER_FMT, (LUAI_UACINT)lua_tointeger(L, index));
+			}
+			else {
+				double d = (double)lua_tonumber(L, index);
+				if (d != d || d == HUGE_VAL || d == -HUGE_VAL) {
+					error = "can not encode nan or inf";
+					return false;
+				}
+				n = snprintf(num, sizeof(num), "%.17g", d);
+			}
+			out.putBytes((const uint8_t*)num, (uint32_t)n);
+			return true;
+		}
+
+		bool encode_value(lua_State* L, int index, byte_buffer& out, int depth, std::string& error);
+
+		bool encode_table(lua_State* L, int index, byte_buffer& out, int depth, std::string& error)
+		{
+			if (depth >= json_codec::max_depth) {
+				error = "table nested too deep (or cyclic)";
+				return false;
+			}
+			if (!lua_checkstack(L, 3)) {
+				error = "stack overflow";
+				return false;
+			}
+
+			// a sequence has exactly the integer keys 1..#t.
+			lua_Unsigned len = lua_rawlen(L, index);
+			lua_Unsigned count = 0;
+			bool sequence = true;
+
+			lua_pushnil(L);
+			while (lua_next(L, index) != 0) {
+				count++;
+				if (sequence) {
+					int isnum = 0;
+					lua_Integer key = lua_tointegerx(L, -2, &isnum);
+					if (!isnum || lua_type(L, -2) != LUA_TNUMBER || key < 1 || (lua_Unsigned)key > len) {
+						sequence = false;
+					}
+				}
+				lua_pop(L, 1);
+			}
+
+			if (sequence && count == len && len > 0) {
+				out.put('[');
+				for (lua_Unsigned i = 1; i <= len; i++) {
+					if (i > 1) {
+						out.put(',');
+					}
+					lua_rawgeti(L, index, (lua_Integer)i);
+					bool ok = encode_value(L, lua_gettop(L), out, depth + 1, error);
+					lua_pop(L, 1);
+					if (!ok) {
+						return false;
+					}
+				}
+				out.put(']');
+				return true;
+			}
+
+			out.put('{');
+			bool first = true;
+			lua_pushnil(L);
+			while (lua_next(L, index) != 0) {
+				int top = lua_gettop(L);
+				if (!first) {
+					out.put(',');
+				}
+				first = false;
+
+				bool ok = true;
+				int key_type = lua_type(L, top - 1);
+				if (key_type == LUA_TSTRING) {
+					size_t klen = 0;
+					const char* k = lua_tolstring(L, top - 1, &klen);
+					put_string(out, k, klen);
+				}
+				else if (key_type == LUA_TNUMBER) {
+					// lua_tolstring would turn the key itself into a string and confuse lua_next.
+					out.put('"');
+					ok = put_number(L, top - 1, out, error);
+					out.put('"');
+				}
+				else {
+					error = std::string("can not encode a ") + lua_typename(L, key_type) + " key";
+					ok = false;
+				}
+
+				if (ok) {
+					out.put(':');
+					ok = encode_value(L, top, out, depth + 1, error);
+				}
+				if (!ok) {
+					lua_pop(L, 2);
+					return false;
+				}
+				lua_pop(L, 1);
+			}
+			out.put('}');
+			return true;
+		}
+
+		bool encode_value(lua_State* L, int index, byte_buffer& out, int depth, std::string& error)
+		{
+			switch (lua_type(L, index)) {
+			case LUA_TNIL:
+				put_literal(out, "null");
+				return true;
+			case LUA_TBOOLEAN:
+				put_literal(out, lua_toboolean(L, index) ? "true" : "false");
+				return true;
+			case LUA_TNUMBER:
+				return put_number(L, index, out, error);
+			case LUA_TSTRING: {
+				size_t len = 0;
+				const char* s = lua_tolstring(L, index, &len);
+				put_string(out, s, len);
+				return true;
+			}
+			case LUA_TTABLE:
+				return encode_table(L, index, out, depth, error);
+			default:
+				error = std::string("can not encode a ") + lua_typename(L, lua_type(L, index));
+				return false;
+			}
+		}
+
+		void put_utf8(std::string& s, uint32_t cp)
+		{
+			if (cp < 0x80) {
+				s.push_back((char)cp);
+			}
+			else if (cp < 0x800) {
+				s.push_back((char)(0xc0 | (cp >> 6)));
+				s.push_back((char)(0x80 | (cp & 0x3f)));
+			}
+			else if (cp < 0x10000) {
+				s.push_back((char)(0xe0 | (cp >> 12)));
+				s.push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+				s.push_back((char)(0x80 | (cp & 0x3f)));
+			}
+			else {
+				s.push_back((char)(0xf0 | (cp >> 18)));
+				s.push_back((char)(0x80 | ((cp >> 12) & 0x3f)));
+				s.push_back((char)(0x80 | ((cp >> 6) & 0x3f)));
+				s.push_back((char)(0x80 | (cp & 0x3f)));
+			}
+		}
+
+		struct decoder {
+			lua_State* L;
+			const uint8_t* end;
+			std::string& error;
+			std::string& scratch;
+
+			const uint8_t* fail(const char* what)
+			{
+				error = what;
+				return NULL;
+			}
+
+			const uint8_t* skip_space(const uint8_t* p)
+			{
+				while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t')) {
+					p++;
+				}
+				return p;
+			}
+
+			const uint8_t* literal(const uint8_t* p, const char* word)
+			{
+				size_t len = strlen(word);
+				if ((size_t)(end - p) < len || memcmp(p, word, len) != 0) {
+					return fail("invalid literal");
+				}
+				return p + len;
+			}
+
+			bool hex4(const uint8_t* p, uint32_t& cp)
+			{
+				if (end - p < 4) {
+					return false;
+				}
+				cp = 0;
+				for (int i = 0; i < 4; i++) {
+					uint8_t c = p[i];
+					cp <<= 4;
+					if (c >= '0' && c <= '9') cp |= c - '0';
+					else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+					else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+					else return false;
+				}
+				return true;
+			}
+
+			// p is just past the opening quote.
+			const uint8_t* string(const uint8_t* p)
+			{
+				const uint8_t* stop = find_escape(p, end);
+				if (stop == end) {
+					return fail("unterminated string");
+				}
+				if (*stop == '"') {
+					// no escapes, push straight from the input.
+					lua_pushlstring(L, (const char*)p, stop - p);
+					return stop + 1;
+				}
+				if (*stop != '\\') {
+					return fail("control character in string");
+				}
+
+				scratch.assign((const char*)p, stop - p);
+				p = stop;
+				while (true) {
+					if (p >= end) {
+						return fail("unterminated string");
+					}
+					if (*p == '"') {
+						break;
+					}
+					if (*p < 0x20) {
+						return fail("control character in string");
+					}
+					if (*p != '\\') {
+						stop = find_escape(p, end);
+						scratch.append((const char*)p, stop - p);
+						p = stop;
+						continue;
+					}
+
+					if (++p >= end) {
+						return fail("unterminated string");
+					}
+					switch (*p++) {
+					case '"': scratch.push_back('"'); break;
+					case '\\': scratch.push_back('\\'); break;
+					case '/': scratch.push_back('/'); break;
+					case 'b': scratch.push_back('\b'); break;
+					case 'f': scratch.push_back('\f'); break;
+					case 'n': scratch.push_back('\n'); break;
+					case 'r': scratch.push_back('\r'); break;
+					case 't': scratch.push_back('\t'); break;
+					case 'u': {
+						uint32_t cp;
+						if (!hex4(p, cp)) {
+							return fail("invalid unicode escape");
+						}
+						p += 4;
+						if (cp >= 0xd800 && cp <= 0xdbff) {
+							uint32_t low;
+							if (end - p < 6 || p[0] != '\\' || p[1] != 'u' || !hex4(p + 2, low) || low < 0xdc00 || low > 0xdfff) {
+								return fail("invalid surrogate pair");
+							}
+							p += 6;
+							cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+						}
+						put_utf8(scratch, cp);
+						break;
+					}
+					default:
+						return fail("invalid escape");
+					}
+				}
+				lua_pushlstring(L, scratch.data(), scratch.size());
+				return p + 1;
+			}
+
+			const uint8_t* number(const uint8_t* p)
+			{
+				const uint8_t* start = p;
+				bool is_float = false;
+
+				if (p < end && *p == '-') p++;
+				const uint8_t* digits = p;
+				while (p < end && *p >= '0' && *p <= '9') p++;
+				if (p == digits) {
+					return fail("invalid number");
+				}
+				if (*digits == '0' && p - digits > 1) {
+					return fail("leading zero in number");
+				}
+				if (p < end && *p == '.') {
+					is_float = true;
+					const uint8_t* fraction = ++p;
+					while (p < end && *p >= '0' && *p <= '9') p++;
+					if (p == fraction) {
+						return fail("no digits after decimal point");
+					}
+				}
+				if (p < end && (*p == 'e' || *p == 'E')) {
+					is_float = true;
+					p++;
+					if (p < end && (*p == '+' || *p == '-')) p++;
+					const uint8_t* exponent = p;
+					while (p < end && *p >= '0' && *p <= '9') p++;
+					if (p == exponent) {
+						return fail("no digits in exponent");
+					}
+				}
+
+				if (!is_float) {
+					// exact integers while they fit, otherwise fall through to a float.
+					bool negative = *start == '-';
+					uint64_t v = 0;
+					bool overflow = false;
+					for (const uint8_t* d = digits; d < p; d++) {
+						if (v > (std::numeric_limits<uint64_t>::max() - (*d - '0')) / 10) {
+							overflow = true;
+							break;
+						}
+						v = v * 10 + (*d - '0');
+					}
+					uint64_t limit = negative
+						? (uint64_t)std::numeric_limits<lua_Integer>::max() + 1
+						: (uint64_t)std::numeric_limits<lua_Integer>::max();
+					if (!overflow && v <= limit) {
+						lua_pushinteger(L, negative ? (lua_Integer)(0 - v) : (lua_Integer)v);
+						return p;
+					}
+				}
+
+				// the input is not nul terminated, so strtod gets a copy.
+				char num[128];
+				size_t len = p - start;
+				if (len >= sizeof(num)) {
+					return fail("number too long");
+				}
+				memcpy(num, start, len);
+				num[len] = '\0';
+				lua_pushnumber(L, (lua_Number)strtod(num, NULL));
+				return p;
+			}
+
+			const uint8_t* array(const uint8_t* p, int depth)
+			{
+				lua_newtable(L);
+				p = skip_space(p);
+				if (p < end && *p == ']') {
+					return p + 1;
+				}
+
+				lua_Integer i = 1;
+				while (true) {
+					p = value(p, depth + 1);
+					if (p == NULL) {
+						return NULL;
+					}
+					// null leaves a hole, so later elements keep their index.
+					lua_rawseti(L, -2, i++);
+
+					p = skip_space(p);
+					if (p >= end) {
+						return fail("unterminated array");
+					}
+					if (*p == ']') {
+						return p + 1;
+					}
+					if (*p != ',') {
+						return fail("expected ',' or ']'");
+					}
+					p++;
+				}
+			}
+
+			const uint8_t* object(const uint8_t* p, int depth)
+			{
+				lua_newtable(L);
+				p = skip_space(p);
+				if (p < end && *p == '}') {
+					return p + 1;
+				}
+
+				while (true) {
+					p = skip_space(p);
+					if (p >= end || *p != '"') {
+						return fail("expected string key");
+					}
+					p = string(p + 1);
+					if (p == NULL) {
+						return NULL;
+					}
+					p = skip_space(p);
+					if (p >= end || *p != ':') {
+						return fail("expected ':'");
+					}
+					p = value(p + 1, depth + 1);
+					if (p == NULL) {
+						return NULL;
+					}
+					lua_rawset(L, -3);
+
+					p = skip_space(p);
+					if (p >= end) {
+						return fail("unterminated object");
+					}
+					if (*p == '}') {
+						return p + 1;
+					}
+					if (*p != ',') {
+						return fail("expected ',' or '}'");
+					}
+					p++;
+				}
+			}
+
+			const uint8_t* value(const uint8_t* p, int depth)
+			{
+				if (depth >= json_codec::max_depth) {
+					return fail("document nested too deep");
+				}
+				if (!lua_checkstack(L, 3)) {
+					return fail("stack overflow");
+				}
+
+				p = skip_space(p);
+				if (p >= end) {
+					return fail("unexpected end of input");
+				}
+
+				switch (*p) {
+				case '{': return object(p + 1, depth);
+				case '[': return array(p + 1, depth);
+				case '"': return string(p + 1);
+				case 't':
+					lua_pushboolean(L, 1);
+					return literal(p, "true");
+				case 'f':
+					lua_pushboolean(L, 0);
+					return literal(p, "false");
+				case 'n':
+					lua_pushnil(L);
+					return literal(p, "null");
+				default:
+					return number(p);
+				}
+			}
+		};
+	}
+
+	bool json_codec::encode(lua_State* L, int index, byte_buffer& out, std::string& error)
+	{
+		return encode_value(L, lua_absindex(L, index), out, 0, error);
+	}
+
+	bool json_codec::decode(lua_State* L, const uint8_t* data, uint32_t size, std::string& error)
+	{
+		int top = lua_gettop(L);
+
+		// not on the stack: a memory error raised by Lua while decoding longjmps past this
+		// frame. Kept per thread, io threads decode at the same time.
+		static thread_local std::string scratch;
+
+		decoder d = { L, data + size, error, scratch };
+		const uint8_t* p = d.value(data, 0);
+		if (p != NULL && d.skip_space(p) != d.end) {
+			p = d.fail("trailing characters");
+		}
+		if (p == NULL) {
+			lua_settop(L, top);
+			return false;
+		}
+		return true;
+	}
+}; // namespace net
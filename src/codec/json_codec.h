@@ -0,0 +1,30 @@
+#ifndef __JSON_CODEC_H__
+#define __JSON_CODEC_H__
+
+#include "lua.hpp"
+#include "../byte_buffer.h"
+#include <string>
+
+namespace net {
+
+	// JSON encoding of Lua values. Sequences become arrays, other tables objects with
+	// string or number keys; null decodes to nil. String bodies are scanned 16 bytes
+	// at a time for quotes, escapes and control characters where SSE2 is available.
+	class json_codec
+	{
+	public:
+		// append the value at index to out, false with error set for values JSON can not
+		// represent (functions, userdata, nan/inf, cycles or nesting deeper than max_depth).
+		static bool encode(lua_State* L, int index, byte_buffer& out, std::string& error);
+
+		// push the document in data, which must hold exactly one value and whitespace.
+		// Returns false with error set and nothing pushed if it is not valid JSON as
+		// RFC 8259 has it: raw control characters in strings, leading zeros and numbers
+		// with an empty fraction or exponent are rejected.
+		static bool decode(lua_State* L, const uint8_t* data, uint32_t size, std::string& error);
+
+		static const int max_depth = 64;
+	};
+}; // namespace net
+
+#endif //__JSON_CODEC_H__
@@ -0,0 +1,188 @@
+#include "lz4_block.h"
+#include <cstring>
+
+namespace net {
+
+	namespace {
+
+		const uint32_t min_match = 4;
+		const uint32_t last_literals = 5;  // the block always ends with this many literals
+		const uint32_t match_find_limit = 12; // no match may start closer than this to the end
+		const uint32_t max_distance = 65535;
+		const int hash_log = 12;
+
+		inline uint32_t load32(const uint8_t* p)
+		{
+			uint32_t v;
+			memcpy(&v, p, sizeof(v));
+			return v;
+		}
+
+		inline uint32_t hash(uint32_t sequence)
+		{
+			return (sequence * 2654435761U) >> (32 - hash_log);
+		}
+
+		inline uint8_t* put_length(uint8_t* op, uint32_t len)
+		{
+			for (; len >= 255; len -= 255) {
+				*op++ = 255;
+			}
+			*op++ = (uint8_t)len;
+			return op;
+		}
+
+		inline uint8_t* put_literals(uint8_t* op, const uint8_t* literals, uint32_t len, uint32_t match_nibble)
+		{
+			uint8_t* token = op++;
+			if (len >= 15) {
+				*token = (uint8_t)((15 << 4) | match_nibble);
+				op = put_length(op, len - 15);
+			}
+			else {
+				*token = (uint8_t)((len << 4) | match_nibble);
+			}
+			memcpy(op, literals, len);
+			return op + len;
+		}
+	}
+
+	uint32_t lz4_block::compress(const uint8_t* src, uint32_t size, uint8_t* dst)
+	{
+		uint8_t* op = dst;
+		uint32_t anchor = 0;
+
+		if (size > match_find_limit) {
+			// positions of the last sequence seen per hash; stale or colliding entries
+			// are weeded out by comparing the bytes.
+			uint32_t table[1 << hash_log];
+			memset(table, 0, sizeof(table));
+
+			const uint32_t match_limit = size - last_literals;
+			const uint32_t search_limit = size - match_find_limit;
+
+			uint32_t ip = 1;
+			uint32_t misses = 0;
+			while (ip < search_limit) {
+				uint32_t sequence = load32(src + ip);
+				uint32_t h = hash(sequence);
+				uint32_t ref = table[h];
+				table[h] = ip;
+
+				if (ip - ref > max_distance || load32(src + ref) != sequence) {
+					// skip faster through data that does not compress.
+					ip += 1 + (misses++ >> 6);
+					continue;
+				}
+				misses = 0;
+
+				while (ip > anchor && ref > 0 && src[ip - 1] == src[ref - 1]) {
+					ip--;
+					ref--;
+				}
+
+				uint32_t len = min_match;
+				while (ip + len < match_limit && src[ip + len] == src[ref + len]) {
+					len++;
+				}
+
+				uint32_t match_code = len - min_match;
+				op = put_literals(op, src + anchor, ip - anchor, match_code >= 15 ? 15 : match_code);
+
+				uint32_t offset = ip - ref;
+				*op++ = (uint8_t)offset;
+				*op++ = (uint8_t)(offset >> 8);
+				if (match_code >= 15) {
+					op = put_length(op, match_code - 15);
+				}
+
+				ip += len;
+				anchor = ip;
+
+				if (ip < search_limit) {
+					table[hash(load32(src + ip - 2))] = ip - 2;
+				}
+			}
+		}
+
+		op = put_literals(op, src + anchor, size - anchor, 0);
+		return (uint32_t)(op - dst);
+	}
+
+	int32_t lz4_block::decompress(const uint8_t* src, uint32_t size, uint8_t* dst, uint32_t capacity)
+	{
+		const uint8_t* ip = src;
+		const uint8_t* const iend = src + size;
+		uint8_t* op = dst;
+		uint8_t* const oend = dst + capacity;
+
+		while (true) {
+			if (ip >= iend) {
+				return -1;
+			}
+			uint32_t token = *ip++;
+
+			size_t literals = token >> 4;
+			if (literals == 15) {
+				uint8_t b;
+				do {
+					if (ip >= iend) {
+						return -1;
+					}
+					b = *ip++;
+					literals += b;
+				} while (b == 255);
+			}
+			if (literals > (size_t)(iend - ip) || literals > (size_t)(oend - op)) {
+				return -1;
+			}
+			memcpy(op, ip, literals);
+			op += literals;
+			ip += literals;
+
+			// the last sequence has literals only.
+			if (ip == iend) {
+				break;
+			}
+
+			if (iend - ip < 2) {
+				return -1;
+			}
+			size_t offset = ip[0] | (ip[1] << 8);
+			ip += 2;
+			if (offset == 0 || offset > (size_t)(op - dst)) {
+				return -1;
+			}
+
+			size_t len = token & 0x0f;
+			if (len == 15) {
+				uint8_t b;
+				do {
+					if (ip >= iend) {
+						return -1;
+					}
+					b = *ip++;
+					len += b;
+				} while (b == 255);
+			}
+			len += min_match;
+			if (len > (size_t)(oend - op)) {
+				return -1;
+			}
+
+			const uint8_t* match = op - offset;
+			if (offset >= len) {
+				memcpy(op, match, len);
+				op += len;
+			}
+			else {
+				// overlapping copy repeats the last offset bytes.
+				for (size_t i = 0; i < len; i++) {
+					*op++ = *match++;
+				}
+			}
+		}
+
+		return (int32_t)(op - dst);
+	}
+}; // namespace net
@@ -0,0 +1,28 @@
+#ifndef __LZ4_BLOCK_H__
+#define __LZ4_BLOCK_H__
+
+#include <stdint.h>
+
+namespace net {
+
+	// Compressor and decoder for the LZ4 block format (no frame header, no checksum):
+	// a greedy single-probe hash of 4-byte sequences, which trades some ratio for
+	// speed in the same way the reference fast mode does.
+	class lz4_block
+	{
+	public:
+		// worst case output size for size bytes of input.
+		static uint32_t bound(uint32_t size)
+		{
+			return size + size / 255 + 16;
+		}
+
+		// dst must hold bound(size) bytes. Returns the compressed size.
+		static uint32_t compress(const uint8_t* src, uint32_t size, uint8_t* dst);
+
+		// Returns the decoded size, or -1 if src is malformed or does not fit capacity.
+		static int32_t decompress(const uint8_t* src, uint32_t size, uint8_t* dst, uint32_t capacity);
+	};
+}; // namespace net
+
+#endif //__LZ4_BLOCK_H__
@@ -0,0 +1,424 @@
+#include "msgpack_codec.h"
+#include <cstring>
+#include <limits>
+
+namespace net {
+
+	namespace {
+
+		void put_double(byte_buffer& out, double value)
+		{
+			uint64_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			out.put(0xcb);
+			out.putLong(bits);
+		}
+
+		void put_integer(byte_buffer& out, lua_Integer value)
+		{
+			if (value >= 0) {
+				if (value < 0x80) {
+					out.put((uint8_t)value);
+				}
+				else if (value <= 0xff) {
+					out.put(0xcc);
+					out.put((uint8_t)value);
+				}
+				else if (value <= 0xffff) {
+					out.put(0xcd);
+					out.putShort((uint16_t)value);
+				}
+				else if (value <= 0xffffffffLL) {
+					out.put(0xce);
+					out.putInt((uint32_t)value);
+				}
+				else {
+					out.put(0xcf);
+					out.putLong((uint64_t)value);
+				}
+			}
+			else {
+				if (value >= -32) {
+					out.put((uint8_t)(int8_t)value);
+				}
+				else if (value >= -128) {
+					out.put(0xd0);
+					out.put((uint8_t)(int8_t)value);
+				}
+				else if (value >= -32768) {
+					out.put(0xd1);
+					out.putShort((uint16_t)(int16_t)value);
+				}
+				else if (value >= (lua_Integer)std::numeric_limits<int32_t>::min()) {
+					out.put(0xd2);
+					out.putInt((uint32_t)(int32_t)value);
+				}
+				else {
+					out.put(0xd3);
+					out.putLong((uint64_t)value);
+				}
+			}
+		}
+
+		void put_string(byte_buffer& out, const char* s, size_t len)
+		{
+			if (len < 32) {
+				out.put((uint8_t)(0xa0 | len));
+			}
+			else if (len <= 0xff) {
+				out.put(0xd9);
+				out.put((uint8_t)len);
+			}
+			else if (len <= 0xffff) {
+				out.put(0xda);
+				out.putShort((uint16_t)len);
+			}
+			else {
+				out.put(0xdb);
+				out.putInt((uint32_t)len);
+			}
+			out.putBytes((const uint8_t*)s, (uint32_t)len);
+		}
+
+		void put_container_header(byte_buffer& out, uint32_t n, bool array)
+		{
+			if (n < 16) {
+				out.put((uint8_t)((array ? 0x90 : 0x80) | n));
+			}
+			else if (n <= 0xffff) {
+				out.put(array ? 0xdc : 0xde);
+				out.putShort((uint16_t)n);
+			}
+			else {
+				out.put(array ? 0xdd : 0xdf);
+				out.putInt(n);
+			}
+		}
+
+		bool encode_value(lua_State* L, int index, byte_buffer& out, int depth, std::string& error);
+
+		bool encode_table(lua_State* L, int index, byte_buffer& out, int depth, std::string& error)
+		{
+			if (depth >= msgpack_codec::max_depth) {
+				error = "table nested too deep (or cyclic)";
+				return false;
+			}
+			if (!lua_checkstack(L, 3)) {
+				error = "stack overflow";
+				return false;
+			}
+
+			// a sequence has exactly the integer keys 1..#t.
+			lua_Unsigned len = lua_rawlen(L, index);
+			lua_Unsigned count = 0;
+			bool sequence = true;
+
+			lua_pushnil(L);
+			while (lua_next(L, index) != 0) {
+				count++;
+				if (sequence) {
+					int isnum = 0;
+					lua_Integer key = lua_tointegerx(L, -2, &isnum);
+					if (!isnum || lua_type(L, -2) != LUA_TNUMBER || key < 1 || (lua_Unsigned)key > len) {
+						sequence = false;
+					}
+				}
+				lua_pop(L, 1);
+			}
+
+			if (count > 0xffffffffULL) {
+				error = "table too large";
+				return false;
+			}
+
+			if (sequence && count == len && len > 0) {
+				put_container_header(out, (uint32_t)len, true);
+				for (lua_Unsigned i = 1; i <= len; i++) {
+					lua_rawgeti(L, index, (lua_Integer)i);
+					bool ok = encode_value(L, lua_gettop(L), out, depth + 1, error);
+					lua_pop(L, 1);
+					if (!ok) {
+						return false;
+					}
+				}
+				return true;
+			}
+
+			put_container_header(out, (uint32_t)count, false);
+			lua_pushnil(L);
+			while (lua_next(L, index) != 0) {
+				int top = lua_gettop(L);
+				if (!encode_value(L, top - 1, out, depth + 1, error) || !encode_value(L, top, out, depth + 1, error)) {
+					lua_pop(L, 2);
+					return false;
+				}
+				lua_pop(L, 1);
+			}
+			return true;
+		}
+
+		bool encode_value(lua_State* L, int index, byte_buffer& out, int depth, std::string& error)
+		{
+			switch (lua_type(L, index)) {
+			case LUA_TNIL:
+				out.put(0xc0);
+				return true;
+			case LUA_TBOOLEAN:
+				out.put(lua_toboolean(L, index) ? 0xc3 : 0xc2);
+				return true;
+			case LUA_TNUMBER:
+				if (lua_isinteger(L, index)) {
+					put_integer(out, lua_tointeger(L, index));
+				}
+				else {
+					put_double(out, (double)lua_tonumber(L, index));
+				}
+				return true;
+			case LUA_TSTRING: {
+				size_t len = 0;
+				const char* s = lua_tolstring(L, index, &len);
+				if (len > 0xffffffffULL) {
+					error = "string too long";
+					return false;
+				}
+				put_string(out, s, len);
+				return true;
+			}
+			case LUA_TTABLE:
+				return encode_table(L, index, out, depth, error);
+			default:
+				error = std::string("can not encode a ") + lua_typename(L, lua_type(L, index));
+				return false;
+			}
+		}
+
+		// big endian reads, callers have checked the bounds.
+		inline uint16_t load16(const uint8_t* p)
+		{
+			return (uint16_t)((p[0] << 8) | p[1]);
+		}
+
+		inline uint32_t load32(const uint8_t* p)
+		{
+			return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+		}
+
+		inline uint64_t load64(const uint8_t* p)
+		{
+			return ((uint64_t)load32(p) << 32) | load32(p + 4);
+		}
+
+		struct decoder {
+			lua_State* L;
+			const uint8_t* end;
+			std::string& error;
+
+			bool need(const uint8_t* p, uint64_t n)
+			{
+				if ((uint64_t)(end - p) < n) {
+					error = "truncated message";
+					return false;
+				}
+				return true;
+			}
+
+			const uint8_t* string(const uint8_t* p, uint64_t len)
+			{
+				if (!need(p, len)) {
+					return NULL;
+				}
+				lua_pushlstring(L, (const char*)p, (size_t)len);
+				return p + len;
+			}
+
+			const uint8_t* array(const uint8_t* p, uint64_t n, int depth)
+			{
+				// every element takes at least one byte, this also bounds the preallocation.
+				if (!need(p, n)) {
+					return NULL;
+				}
+				lua_createtable(L, (int)n, 0);
+				for (uint64_t i = 1; i <= n; i++) {
+					p = value(p, depth + 1);
+					if (p == NULL) {
+						return NULL;
+					}
+					lua_rawseti(L, -2, (lua_Integer)i);
+				}
+				return p;
+			}
+
+			const uint8_t* map(const uint8_t* p, uint64_t n, int depth)
+			{
+				if (!need(p, n * 2)) {
+					return NULL;
+				}
+				lua_createtable(L, 0, (int)n);
+				for (uint64_t i = 0; i < n; i++) {
+					p = value(p, depth + 1);
+					if (p == NULL) {
+						return NULL;
+					}
+					if (lua_isnil(L, -1) || (lua_type(L, -1) == LUA_TNUMBER && lua_tonumber(L, -1) != lua_tonumber(L, -1))) {
+						error = "invalid map key";
+						return NULL;
+					}
+					p = value(p, depth + 1);
+					if (p == NULL) {
+						return NULL;
+					}
+					lua_rawset(L, -3);
+				}
+				return p;
+			}
+
+			const uint8_t* value(const uint8_t* p, int depth)
+			{
+				if (depth >= msgpack_codec::max_depth) {
+					error = "message nested too deep";
+					return NULL;
+				}
+				if (!lua_checkstack(L, 3)) {
+					error = "stack overflow";
+					return NULL;
+				}
+				if (!need(p, 1)) {
+					return NULL;
+				}
+
+				uint8_t b = *p++;
+
+				if (b <= 0x7f) {
+					lua_pushinteger(L, b);
+					return p;
+				}
+				if (b >= 0xe0) {
+					lua_pushinteger(L, (int8_t)b);
+					return p;
+				}
+				if ((b & 0xf0) == 0x80) {
+					return map(p, b & 0x0f, depth);
+				}
+				if ((b & 0xf0) == 0x90) {
+					return array(p, b & 0x0f, depth);
+				}
+				if ((b & 0xe0) == 0xa0) {
+					return string(p, b & 0x1f);
+				}
+
+				switch (b) {
+				case 0xc0:
+					lua_pushnil(L);
+					return p;
+				case 0xc2:
+					lua_pushboolean(L, 0);
+					return p;
+				case 0xc3:
+					lua_pushboolean(L, 1);
+					return p;
+				case 0xc4:
+				case 0xd9:
+					if (!need(p, 1)) return NULL;
+					return string(p + 1, p[0]);
+				case 0xc5:
+				case 0xda:
+					if (!need(p, 2)) return NULL;
+					return string(p + 2, load16(p));
+				case 0xc6:
+				case 0xdb:
+					if (!need(p, 4)) return NULL;
+					return string(p + 4, load32(p));
+				case 0xca: {
+					if (!need(p, 4)) return NULL;
+					uint32_t bits = load32(p);
+					float f;
+					memcpy(&f, &bits, sizeof(f));
+					lua_pushnumber(L, (lua_Number)f);
+					return p + 4;
+				}
+				case 0xcb: {
+					if (!need(p, 8)) return NULL;
+					uint64_t bits = load64(p);
+					double d;
+					memcpy(&d, &bits, sizeof(d));
+					lua_pushnumber(L, (lua_Number)d);
+					return p + 8;
+				}
+				case 0xcc:
+					if (!need(p, 1)) return NULL;
+					lua_pushinteger(L, p[0]);
+					return p + 1;
+				case 0xcd:
+					if (!need(p, 2)) return NULL;
+					lua_pushinteger(L, load16(p));
+					return p + 2;
+				case 0xce:
+					if (!need(p, 4)) return NULL;
+					lua_pushinteger(L, (lua_Integer)load32(p));
+					return p + 4;
+				case 0xcf: {
+					if (!need(p, 8)) return NULL;
+					uint64_t v = load64(p);
+					if (v > (uint64_t)std::numeric_limits<lua_Integer>::max()) {
+						lua_pushnumber(L, (lua_Number)v);
+					}
+					else {
+						lua_pushinteger(L, (lua_Integer)v);
+					}
+					return p + 8;
+				}
+				case 0xd0:
+					if (!need(p, 1)) return NULL;
+					lua_pushinteger(L, (int8_t)p[0]);
+					return p + 1;
+				case 0xd1:
+					if (!need(p, 2)) return NULL;
+					lua_pushinteger(L, (int16_t)load16(p));
+					return p + 2;
+				case 0xd2:
+					if (!need(p, 4)) return NULL;
+					lua_pushinteger(L, (int32_t)load32(p));
+					return p + 4;
+				case 0xd3:
+					if (!need(p, 8)) return NULL;
+					lua_pushinteger(L, (lua_Integer)(int64_t)load64(p));
+					return p + 8;
+				case 0xdc:
+					if (!need(p, 2)) return NULL;
+					return array(p + 2, load16(p), depth);
+				case 0xdd:
+					if (!need(p, 4)) return NULL;
+					return array(p + 4, load32(p), depth);
+				case 0xde:
+					if (!need(p, 2)) return NULL;
+					return map(p + 2, load16(p), depth);
+				case 0xdf:
+					if (!need(p, 4)) return NULL;
+					return map(p + 4, load32(p), depth);
+				default:
+					// 0xc1 is never used, 0xc7-0xc9 and 0xd4-0xd8 are extension types.
+					error = "unsupported type byte";
+					return NULL;
+				}
+			}
+		};
+	}
+
+	bool msgpack_codec::encode(lua_State* L, int index, byte_buffer& out, std::string& error)
+	{
+		return encode_value(L, lua_absindex(L, index), out, 0, error);
+	}
+
+	uint32_t msgpack_codec::decode(lua_State* L, const uint8_t* data, uint32_t size, std::string& error)
+	{
+		int top = lua_gettop(L);
+
+		decoder d = { L, data + size, error };
+		const uint8_t* end = d.value(data, 0);
+		if (end == NULL) {
+			lua_settop(L, top);
+			return 0;
+		}
+		return (uint32_t)(end - data);
+	}
+}; // namespace net
@@ -0,0 +1,27 @@
+#ifndef __MSGPACK_CODEC_H__
+#define __MSGPACK_CODEC_H__
+
+#include "lua.hpp"
+#include "../byte_buffer.h"
+#include <string>
+
+namespace net {
+
+	// MessagePack encoding of Lua values. Sequences (keys 1..n and nothing else) become
+	// arrays, other tables maps; integers and floats keep their Lua subtype.
+	class msgpack_codec
+	{
+	public:
+		// append the value at index to out, false with error set for values that can not
+		// be represented (functions, userdata, cycles or nesting deeper than max_depth).
+		static bool encode(lua_State* L, int index, byte_buffer& out, std::string& error);
+
+		// push the value starting at data, returns the number of bytes consumed or 0 with
+		// error set and nothing pushed when the input is truncated or malformed.
+		static uint32_t decode(lua_State* L, const uint8_t* data, uint32_t size, std::string& error);
+
+		static const int max_depth = 64;
+	};
+}; // namespace net
+
+#endif //__MSGPACK_CODEC_H__
@@ -0,0 +1,302 @@
+#include "lua_allocator.h"
+#include <boost/thread/mutex.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+	const size_t size_class_granularity = 16;
+	const size_t size_class_count = LUAALLOC_MAX_SMALL / size_class_granularity;
+	const size_t pool_chunk_size = 64 * 1024;
+
+	// blocks a thread cache holds per class before half of them go to the shared list,
+	// and how many it takes from there at once.
+	const size_t thread_cache_limit = 256;
+	const size_t thread_cache_batch = thread_cache_limit / 2;
+
+	struct free_block {
+		free_block* next;
+	};
+
+	// chunks carved into blocks are never returned to the system; a freed block
+	// goes back to its class and is handed out again to any thread.
+	struct free_list {
+		boost::mutex mutex;
+		free_block* head;
+
+		free_list() : head(NULL) {}
+	};
+
+	free_list& free_lists(size_t cls)
+	{
+		static free_list lists[size_class_count];
+		return lists[cls];
+	}
+
+	inline size_t size_class(size_t size)
+	{
+		return (size - 1) / size_class_granularity;
+	}
+
+	// the blocks a thread gets and puts without taking a lock. Whatever is left when
+	// the thread ends goes to the shared lists, where other threads find it.
+	class thread_cache
+	{
+	public:
+		thread_cache()
+		{
+			for (size_t cls = 0; cls < size_class_count; cls++) {
+				free_lists(cls); // constructed first, so destroyed after every cache.
+				m_heads[cls] = NULL;
+				m_counts[cls] = 0;
+			}
+		}
+
+		~thread_cache()
+		{
+			for (size_t cls = 0; cls < size_class_count; cls++) {
+				flush(cls, m_counts[cls]);
+			}
+		}
+
+		void* get(size_t cls)
+		{
+			if (m_heads[cls] == NULL && !fetch(cls)) {
+				return NULL;
+			}
+			free_block* b = m_heads[cls];
+			m_heads[cls] = b->next;
+			m_counts[cls]--;
+			return b;
+		}
+
+		void put(void* ptr, size_t cls)
+		{
+			free_block* b = static_cast<free_block*>(ptr);
+			b->next = m_heads[cls];
+			m_heads[cls] = b;
+			if (++m_counts[cls] > thread_cache_limit) {
+				flush(cls, thread_cache_batch);
+			}
+		}
+
+	private:
+		// moves up to a batch from the shared list, or carves a new chunk if it is empty.
+		bool fetch(size_t cls)
+		{
+			free_list& list = free_lists(cls);
+			{
+				boost::mutex::scoped_lock lock(list.mutex);
+				while (list.head != NULL && m_counts[cls] < thread_cache_batch) {
+					free_block* b = list.head;
+					list.head = b->next;
+					b->next = m_heads[cls];
+					m_heads[cls] = b;
+					m_counts[cls]++;
+				}
+			}
+			return m_heads[cls] != NULL || carve(cls);
+		}
+
+		bool carve(size_t cls)
+		{
+			size_t block_size = (cls + 1) * size_class_granularity;
+			uint8_t* chunk = static_cast<uint8_t*>(malloc(pool_chunk_size));
+			if (chunk == NULL) {
+				return false;
+			}
+
+			size_t count = pool_chunk_size / block_size;
+			for (size_t i = 0; i < count; i++) {
+				free_block* b = reinterpret_cast<free_block*>(chunk + i * block_size);
+				b->next = m_heads[cls];
+				m_heads[cls] = b;
+			}
+			m_counts[cls] += count;
+			return true;
+		}
+
+		// the first count blocks go to the shared list in one splice.
+		void flush(size_t cls, size_t count)
+		{
+			if (count == 0) {
+				return;
+			}
+
+			free_block* first = m_heads[cls];
+			free_block* last = first;
+			for (size_t i = 1; i < count; i++) {
+				last = last->next;
+			}
+			m_heads[cls] = last->next;
+			m_counts[cls] -= count;
+
+			free_list& list = free_lists(cls);
+			boost::mutex::scoped_lock lock(list.mutex);
+			last->next = list.head;
+			list.head = first;
+		}
+
+	private:
+		free_block* m_heads[size_class_count];
+		size_t m_counts[size_class_count];
+	};
+
+	thread_cache& local_cache()
+	{
+		static thread_local thread_cache cache;
+		return cache;
+	}
+
+	void* pool_get(size_t size)
+	{
+		return local_cache().get(size_class(size));
+	}
+
+	void pool_put(void* ptr, size_t size)
+	{
+		local_cache().put(ptr, size_class(size));
+	}
+
+	void* accounting_alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+	{
+		lua_alloc_state* s = static_cast<lua_alloc_state*>(ud);
+
+		// when ptr is NULL, osize carries the type of the new object, not a size.
+		size_t old_size = ptr ? osize : 0;
+
+		if (nsize <= old_size) {
+			void* ret = s->backend(NULL, ptr, osize, nsize);
+			if (ret != NULL || nsize == 0) {
+				s->used -= old_size - nsize;
+			}
+			return ret;
+		}
+
+		// reserve the growth first, so two threads can not both pass the limit check.
+		size_t growth = nsize - old_size;
+		size_t used = s->used.load(std::memory_order_relaxed);
+		do {
+			if (s->limit != 0 && used + growth > s->limit) {
+				return NULL;
+			}
+		} while (!s->used.compare_exchange_weak(used, used + growth, std::memory_order_relaxed));
+
+		void* ret = s->backend(NULL, ptr, osize, nsize);
+		if (ret == NULL) {
+			s->used -= growth;
+			return NULL;
+		}
+
+		used += growth;
+		size_t peak = s->peak.load(std::memory_order_relaxed);
+		while (used > peak && !s->peak.compare_exchange_weak(peak, used, std::memory_order_relaxed)) {
+		}
+		return ret;
+	}
+
+	int panic(lua_State* L)
+	{
+		fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", lua_tostring(L, -1));
+		return 0;
+	}
+}
+
+void* luaalloc_default(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	(void)ud;
+	(void)osize;
+
+	if (nsize == 0) {
+		free(ptr);
+		return NULL;
+	}
+	return realloc(ptr, nsize);
+}
+
+void* luaalloc_pool(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	(void)ud;
+
+	if (ptr == NULL) {
+		if (nsize == 0) {
+			return NULL;
+		}
+		return nsize <= LUAALLOC_MAX_SMALL ? pool_get(nsize) : malloc(nsize);
+	}
+
+	bool old_small = osize <= LUAALLOC_MAX_SMALL;
+
+	if (nsize == 0) {
+		if (old_small) {
+			pool_put(ptr, osize);
+		}
+		else {
+			free(ptr);
+		}
+		return NULL;
+	}
+
+	bool new_small = nsize <= LUAALLOC_MAX_SMALL;
+
+	if (!old_small && !new_small) {
+		return realloc(ptr, nsize);
+	}
+
+	if (old_small && new_small && size_class(osize) == size_class(nsize)) {
+		return ptr;
+	}
+
+	void* ret = new_small ? pool_get(nsize) : malloc(nsize);
+	if (ret == NULL) {
+		// Lua assumes shrinking never fails. A large block is at least as big as any
+		// size class, so keep it and let it join the small lists when it is freed.
+		return nsize < osize ? ptr : NULL;
+	}
+
+	memcpy(ret, ptr, osize < nsize ? osize : nsize);
+
+	if (old_small) {
+		pool_put(ptr, osize);
+	}
+	else {
+		free(ptr);
+	}
+	return ret;
+}
+
+lua_State* luaalloc_newstate(lua_Alloc backend, size_t limit)
+{
+	lua_alloc_state* s = new lua_alloc_state();
+	s->backend = backend ? backend : luaalloc_default;
+	s->used = 0;
+	s->peak = 0;
+	s->limit = limit;
+
+	lua_State* L = lua_newstate(accounting_alloc, s);
+	if (L == NULL) {
+		delete s;
+		return NULL;
+	}
+
+	lua_atpanic(L, &panic);
+	return L;
+}
+
+void luaalloc_close(lua_State* L)
+{
+	lua_alloc_state* s = luaalloc_state(L);
+	lua_close(L);
+	delete s;
+}
+
+lua_alloc_state* luaalloc_state(lua_State* L)
+{
+	void* ud = NULL;
+	if (lua_getallocf(L, &ud) != accounting_alloc) {
+		return NULL;
+	}
+	return static_cast<lua_alloc_state*>(ud);
+}
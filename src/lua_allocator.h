@@ -0,0 +1,40 @@
+#ifndef __LUA_ALLOCATOR_H__
+#define __LUA_ALLOCATOR_H__
+
+
+#include "lua.hpp"
+#include <atomic>
+#include <cstddef>
+
+
+// Per-VM memory accounting, passed as the ud of the lua_Alloc installed by luaalloc_newstate.
+// Every request is forwarded to backend; growing requests beyond limit fail, which makes
+// Lua run a full collection and raise a memory error if that does not help.
+// used and peak are atomic: the state is driven from the script's thread and io threads.
+struct lua_alloc_state {
+	lua_Alloc backend;
+	std::atomic<size_t> used;
+	std::atomic<size_t> peak;
+	size_t limit; // 0 for no limit
+};
+
+// realloc/free based allocator, the same as luaL_newstate uses; the backend when none is given.
+extern void* luaalloc_default(void* ud, void* ptr, size_t osize, size_t nsize);
+
+// Blocks up to LUAALLOC_MAX_SMALL bytes come from size-class free lists, larger ones from
+// realloc. Each thread gets and puts blocks on its own lists without a lock; past a bound,
+// and when the thread ends, they go to process wide lists that every thread refills from.
+// Lua frees memory on whichever io thread runs a callback and those threads end with
+// their sessions, so nothing may stay behind on a thread's lists.
+#define LUAALLOC_MAX_SMALL 256
+extern void* luaalloc_pool(void* ud, void* ptr, size_t osize, size_t nsize);
+
+// backend NULL for luaalloc_default.
+extern lua_State* luaalloc_newstate(lua_Alloc backend, size_t limit);
+extern void luaalloc_close(lua_State* L);
+
+// NULL if L was not created by luaalloc_newstate.
+extern lua_alloc_state* luaalloc_state(lua_State* L);
+
+
+#endif // !__LUA_ALLOCATOR_H__
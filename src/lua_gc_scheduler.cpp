@@ -0,0 +1,67 @@
+#include "lua_gc_scheduler.h"
+#include <chrono>
+
+typedef std::chrono::steady_clock gc_clock;
+
+// its address is the registry key of the per-state lua_gc_stats.
+static const char gc_stats_key = 0;
+
+lua_gc_stats* luagc_stats(lua_State* L)
+{
+	lua_rawgetp(L, LUA_REGISTRYINDEX, &gc_stats_key);
+	lua_gc_stats* stats = static_cast<lua_gc_stats*>(lua_touserdata(L, -1));
+	lua_pop(L, 1);
+	return stats;
+}
+
+void luagc_set_budget(lua_State* L, uint32_t us_per_step)
+{
+	lua_gc_stats* stats = luagc_stats(L);
+	if (stats == NULL) {
+		stats = static_cast<lua_gc_stats*>(lua_newuserdata(L, sizeof(lua_gc_stats)));
+		stats->steps = 0;
+		stats->cycles = 0;
+		stats->pause_total_us = 0;
+		stats->pause_max_us = 0;
+		stats->resume_kb = 0;
+		lua_rawsetp(L, LUA_REGISTRYINDEX, &gc_stats_key);
+	}
+	stats->budget_us = us_per_step;
+}
+
+void luagc_idle_step(lua_State* L)
+{
+	lua_gc_stats* stats = luagc_stats(L);
+	if (stats == NULL || stats->budget_us == 0) {
+		return;
+	}
+
+	// after a finished cycle, leave the heap alone until it has grown by half,
+	// instead of collecting continuously whenever the loop is idle.
+	if (lua_gc(L, LUA_GCCOUNT, 0) < stats->resume_kb) {
+		return;
+	}
+
+	gc_clock::time_point start = gc_clock::now();
+	gc_clock::time_point deadline = start + std::chrono::microseconds(stats->budget_us);
+	gc_clock::time_point now = start;
+
+	// one basic step at a time, so the budget is overrun by at most a single step.
+	do {
+		stats->steps++;
+		if (lua_gc(L, LUA_GCSTEP, 0)) {
+			stats->cycles++;
+			int kb = lua_gc(L, LUA_GCCOUNT, 0);
+			stats->resume_kb = kb + kb / 2;
+			now = gc_clock::now();
+			break;
+		}
+		now = gc_clock::now();
+	} while (now < deadline);
+
+	uint64_t pause = std::chrono::duration_cast<std::chrono::microseconds>(now - start).count();
+	stats->pause_total_us += pause;
+	if (pause > stats->pause_max_us) {
+		stats->pause_max_us = pause;
+	}
+}
@@ -0,0 +1,34 @@
+#ifndef __LUA_GC_SCHEDULER_H__
+#define __LUA_GC_SCHEDULER_H__
+
+
+#include "lua.hpp"
+#include <cstdint>
+
+
+// Incremental collection work done while the script is idle, so that less of
+// it is left for allocations inside message callbacks. It runs only where the
+// script asks for it (net.gcStep), on the thread that owns the state; io
+// threads never step the collector on their own.
+// The pause figures count these idle steps only; collection that Lua runs
+// from allocations inside callbacks is not included.
+struct lua_gc_stats {
+	uint32_t budget_us; // 0 disables idle stepping
+	uint64_t steps;
+	uint64_t cycles;
+	uint64_t pause_total_us;
+	uint64_t pause_max_us;
+	int resume_kb; // heap size at which the next cycle may start from idle
+};
+
+extern void luagc_set_budget(lua_State* L, uint32_t us_per_step);
+
+// Run incremental steps for at most the configured budget. Only from the
+// thread that runs the script.
+extern void luagc_idle_step(lua_State* L);
+
+// NULL until a budget has been set on L.
+extern lua_gc_stats* luagc_stats(lua_State* L);
+
+
+#endif // !__LUA_GC_SCHEDULER_H__
@@ -0,0 +1,252 @@
+#include "lua_script_cache.h"
+#include "sha256.h"
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <iomanip>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using boost::interprocess::file_mapping;
+using boost::interprocess::mapped_region;
+
+namespace {
+
+	struct chunk_reader_state {
+		const char* data;
+		size_t size;
+	};
+
+	// hands the whole mapped region to lua_load in one piece.
+	const char* chunk_reader(lua_State* L, void* ud, size_t* size)
+	{
+		(void)L;
+		chunk_reader_state* s = static_cast<chunk_reader_state*>(ud);
+		if (s->size == 0) {
+			return NULL;
+		}
+		const char* p = s->data;
+		*size = s->size;
+		s->size = 0;
+		return p;
+	}
+
+	int chunk_writer(lua_State* L, const void* p, size_t sz, void* ud)
+	{
+		(void)L;
+		static_cast<std::string*>(ud)->append(static_cast<const char*>(p), sz);
+		return 0;
+	}
+
+	int load_chunk(lua_State* L, const char* data, size_t size, const std::string& chunkname, const char* mode)
+	{
+		chunk_reader_state s = { data, size };
+		return lua_load(L, chunk_reader, &s, chunkname.c_str(), mode);
+	}
+
+	bool is_precompiled(const char* data, size_t size)
+	{
+		return size > 0 && data[0] == LUA_SIGNATURE[0];
+	}
+
+	// A cache file is [magic:4][source size:8][sha256 of chunkname and source:32][bytecode].
+	// The file name is only a 64-bit hash, so the header has to match the source as well
+	// before the bytecode is trusted.
+	const char cache_magic[4] = { 'L', 'C', 'C', '1' };
+	const size_t cache_header_size = sizeof(cache_magic) + sizeof(uint64_t) + sha256_digest_size;
+
+	struct source_id {
+		uint64_t size;
+		uint8_t digest[sha256_digest_size];
+	};
+
+	source_id identify(const std::string& chunkname, const char* data, size_t size)
+	{
+		source_id id;
+		id.size = size;
+
+		sha256_state s;
+		sha256_init(&s);
+		// with its terminator, so that name and source can not be shifted into each other.
+		sha256_update(&s, chunkname.c_str(), chunkname.size() + 1);
+		sha256_update(&s, data, size);
+		sha256_final(&s, id.digest);
+		return id;
+	}
+
+	void put_header(std::string& out, const source_id& id)
+	{
+		out.append(cache_magic, sizeof(cache_magic));
+		for (int i = 0; i < 8; i++) {
+			out.push_back(static_cast<char>(id.size >> (56 - i * 8)));
+		}
+		out.append(reinterpret_cast<const char*>(id.digest), sha256_digest_size);
+	}
+
+	bool header_matches(const char* data, size_t size, const source_id& id)
+	{
+		if (size < cache_header_size || memcmp(data, cache_magic, sizeof(cache_magic)) != 0) {
+			return false;
+		}
+		data += sizeof(cache_magic);
+
+		uint64_t source_size = 0;
+		for (int i = 0; i < 8; i++) {
+			source_size = (source_size << 8) | static_cast<uint8_t>(data[i]);
+		}
+		data += sizeof(uint64_t);
+
+		return source_size == id.size && memcmp(data, id.digest, sha256_digest_size) == 0;
+	}
+
+	std::string cache_path(const char* cache_dir, uint64_t hash)
+	{
+		std::ostringstream os;
+		os << cache_dir << "/" << std::hex << std::setw(16) << std::setfill('0') << hash << ".luac";
+		return os.str();
+	}
+
+	// try to load the cached bytecode of the source id stands for, returns false if there
+	// is none or it was compiled from something else.
+	bool load_cached(lua_State* L, const std::string& path, const std::string& chunkname, const source_id& id)
+	{
+		try {
+			file_mapping file(path.c_str(), boost::interprocess::read_only);
+			mapped_region region(file, boost::interprocess::read_only);
+
+			const char* data = static_cast<const char*>(region.get_address());
+			size_t size = region.get_size();
+			if (!header_matches(data, size, id)) {
+				return false;
+			}
+
+			data += cache_header_size;
+			size -= cache_header_size;
+			if (!is_precompiled(data, size)) {
+				return false;
+			}
+			if (load_chunk(L, data, size, chunkname, "b") != LUA_OK) {
+				// built by another Lua version or truncated, recompile.
+				lua_pop(L, 1);
+				return false;
+			}
+			return true;
+		}
+		catch (const boost::interprocess::interprocess_exception&) {
+			return false;
+		}
+	}
+
+	void store_cached(lua_State* L, const std::string& path, const source_id& id)
+	{
+		std::string bytecode;
+		put_header(bytecode, id);
+		if (lua_dump(L, chunk_writer, &bytecode, 0) != 0) {
+			return;
+		}
+
+		// write aside and rename, so workers starting together never map a half written file.
+		// mkstemp gives every writer, in this process or another, its own temp file.
+		std::string tmp = path + ".XXXXXX";
+		int fd = ::mkstemp(&tmp[0]);
+		if (fd < 0) {
+			return;
+		}
+
+		bool written = true;
+		const char* p = bytecode.data();
+		size_t left = bytecode.size();
+		while (left > 0) {
+			ssize_t n = ::write(fd, p, left);
+			if (n <= 0) {
+				written = false;
+				break;
+			}
+			p += n;
+			left -= n;
+		}
+
+		// mkstemp creates the file 0600, let workers running as other users read it.
+		written = ::fchmod(fd, 0644) == 0 && written;
+
+		if (::close(fd) != 0 || !written || std::rename(tmp.c_str(), path.c_str()) != 0) {
+			std::remove(tmp.c_str());
+		}
+	}
+}
+
+uint64_t luacache_hash(const char* data, size_t len, uint64_t hash)
+{
+	// FNV-1a
+	for (size_t i = 0; i < len; i++) {
+		hash ^= static_cast<uint8_t>(data[i]);
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+int luacache_loadfile(lua_State* L, const char* filename, const char* cache_dir)
+{
+	std::string chunkname = std::string("@") + filename;
+
+	try {
+		file_mapping file(filename, boost::interprocess::read_only);
+
+		// an empty file cannot be mapped, but is a valid (empty) script.
+		struct stat st;
+		if (::fstat(file.get_mapping_handle().handle, &st) == 0 && st.st_size == 0) {
+			return load_chunk(L, "", 0, chunkname, "t");
+		}
+
+		mapped_region region(file, boost::interprocess::read_only);
+
+		const char* data = static_cast<const char*>(region.get_address());
+		size_t size = region.get_size();
+
+		if (is_precompiled(data, size)) {
+			return load_chunk(L, data, size, chunkname, "b");
+		}
+
+		// skip a leading '#' line as luaL_loadfile does, keeping the newline so line numbers match.
+		if (size > 0 && data[0] == '#') {
+			const char* eol = static_cast<const char*>(memchr(data, '\n', size));
+			size_t skip = eol ? (eol - data) : size;
+			data += skip;
+			size -= skip;
+		}
+
+		if (cache_dir == NULL) {
+			return load_chunk(L, data, size, chunkname, "t");
+		}
+
+		// the chunkname is compiled into the bytecode, so it is part of the key.
+		uint64_t hash = luacache_hash(chunkname.data(), chunkname.size());
+		std::string path = cache_path(cache_dir, luacache_hash(data, size, hash));
+		source_id id = identify(chunkname, data, size);
+		if (load_cached(L, path, chunkname, id)) {
+			return LUA_OK;
+		}
+
+		int status = load_chunk(L, data, size, chunkname, "t");
+		if (status == LUA_OK) {
+			store_cached(L, path, id);
+		}
+		return status;
+	}
+	catch (const boost::interprocess::interprocess_exception& e) {
+		lua_pushfstring(L, "cannot open %s: %s", filename, e.what());
+		return LUA_ERRFILE;
+	}
+}
+
+int luacache_dofile(lua_State* L, const char* filename, const char* cache_dir)
+{
+	int status = luacache_loadfile(L, filename, cache_dir);
+	if (status != LUA_OK) {
+		return status;
+	}
+	return lua_pcall(L, 0, LUA_MULTRET, 0);
+}
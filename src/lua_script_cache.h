@@ -0,0 +1,23 @@
+#ifndef __LUA_SCRIPT_CACHE_H__
+#define __LUA_SCRIPT_CACHE_H__
+
+
+#include "lua.hpp"
+#include <cstdint>
+#include <string>
+
+
+// Load a script from a memory-mapped file. Precompiled chunks (luac output or
+// lua_dump bundles) are loaded directly; source files are compiled once and the
+// bytecode is kept in cache_dir, keyed by a hash of the chunkname and source text.
+// A cached chunk is only used if the source size and SHA-256 stored with it match.
+// cache_dir may be NULL to disable the cache.
+// Returns a lua_load status and leaves the chunk (or an error message) on the stack.
+extern int luacache_loadfile(lua_State* L, const char* filename, const char* cache_dir);
+extern int luacache_dofile(lua_State* L, const char* filename, const char* cache_dir);
+
+// FNV-1a; pass an earlier result as hash to continue it over more data.
+extern uint64_t luacache_hash(const char* data, size_t len, uint64_t hash = 14695981039346656037ULL);
+
+
+#endif // !__LUA_SCRIPT_CACHE_H__
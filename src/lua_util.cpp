@@ -54,32 +54,48 @@ int luautil_unref_function(lua_State* L, int ref)
 int luautil_call_ref(lua_State* L, int ref)
 {
 	lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
-	lua_pcall(L, 0, 0, 0);
-	lua_pop(L, 1);
+	if (lua_pcall(L, 0, 0, 0) != LUA_OK) {
+		lua_pop(L, 1); // error message
+	}
 
 	return 0;
 }
 
-int luautil_call_ref(lua_State* L, int ref, std::string json)
-{
-	lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
-	lua_pushlstring(L, json.c_str(), json.length());
+namespace {
+	struct string_arg {
+		const char* data;
+		size_t len;
+	};
 
-	lua_pcall(L, 1, 0, 0);
-
-	lua_pop(L, 2);
+	// [string_arg] [function]: call the function with the string. The string is pushed
+	// under lua_pcall, so an allocation failing against the memory limit is a Lua error,
+	// not a panic.
+	int call_with_string(lua_State* L)
+	{
+		const string_arg* arg = static_cast<const string_arg*>(lua_touserdata(L, 1));
+		lua_pushlstring(L, arg->data, arg->len);
+		lua_call(L, 1, 0);
+		return 0;
+	}
+}
 
-	return 0;
+int luautil_call_ref(lua_State* L, int ref, std::string json)
+{
+	return luautil_call_ref(L, ref, json.c_str(), json.length());
 }
 
 int luautil_call_ref(lua_State* L, int ref, const char* jsonp, size_t len)
 {
-	lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
-	lua_pushlstring(L, jsonp, len);
+	string_arg arg = { jsonp, len };
 
-	lua_pcall(L, 1, 0, 0);
+	// none of these allocate.
+	lua_pushcfunction(L, call_with_string);
+	lua_pushlightuserdata(L, &arg);
+	lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
 
-	lua_pop(L, 2);
+	if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+		lua_pop(L, 1); // error message
+	}
 
 	return 0;
-}
\ No newline at end of file
+}
\ No newline at end of file
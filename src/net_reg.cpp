@@ -0,0 +1,240 @@
+#include "net_reg.h"
+#include "lua_gc_scheduler.h"
+#include "lua_allocator.h"
+#include "tcp/tcp_session_pool.h"
+#include "tcp/tcp_client.h"
+#include "tcp/tcp_client_data.h"
+#include "tcp/tcp_client_reg.h"
+#include "tcp/tcp_session_data.h"
+#include "thread_affinity.h"
+#include <string>
+#include <vector>
+
+static const char* packageName = "net";
+
+static int net_setGcBudget(lua_State* L)
+{
+	lua_Integer us = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, us >= 0, 1, "budget must not be negative");
+
+	luagc_set_budget(L, (uint32_t)us);
+	return 0;
+}
+
+// the script calls this from its own loop when it has time to spare, the only
+// place idle steps run, so they never race the script for the state.
+static int net_gcStep(lua_State* L)
+{
+	luagc_idle_step(L);
+	return 0;
+}
+
+static void set_field(lua_State* L, const char* name, lua_Integer value)
+{
+	lua_pushinteger(L, value);
+	lua_setfield(L, -2, name);
+}
+
+static int net_gcStats(lua_State* L)
+{
+	lua_newtable(L);
+
+	lua_gc_stats* stats = luagc_stats(L);
+	if (stats) {
+		set_field(L, "budget_us", stats->budget_us);
+		set_field(L, "steps", stats->steps);
+		set_field(L, "cycles", stats->cycles);
+		set_field(L, "pause_total_us", stats->pause_total_us);
+		set_field(L, "pause_max_us", stats->pause_max_us);
+	}
+
+	lua_alloc_state* mem = luaalloc_state(L);
+	if (mem) {
+		set_field(L, "memory_used", mem->used);
+		set_field(L, "memory_peak", mem->peak);
+		set_field(L, "memory_limit", mem->limit);
+	}
+	else {
+		set_field(L, "memory_used", (lua_Integer)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0));
+	}
+
+	return 1;
+}
+
+static int net_setSessionPoolSize(lua_State* L)
+{
+	lua_Integer size = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, size >= 0, 1, "pool size must not be negative");
+
+	net::tcp_session_pool::instance().capacity((size_t)size);
+	return 0;
+}
+
+// net.pinLuaThread(cpu) pins the thread running the script, false if it could not be.
+static int net_pinLuaThread(lua_State* L)
+{
+	lua_Integer cpu = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, cpu >= 0 && cpu <= 0xffff, 1, "cpu out of range");
+
+	lua_pushboolean(L, net::affinity::pin_current_thread((int)cpu));
+	return 1;
+}
+
+// net.setIoCpus{cpus} hands these cpus out in turn to the io threads of sessions that
+// connect without a cpu of their own; callbacks run there too, so all of a session's
+// work stays on one core. An empty table leaves them to the scheduler again.
+static int net_setIoCpus(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	std::vector<int> cpus;
+	lua_Integer count = luaL_len(L, 1);
+	for (lua_Integer i = 1; i <= count; i++) {
+		lua_rawgeti(L, 1, i);
+		lua_Integer cpu = luaL_checkinteger(L, -1);
+		lua_pop(L, 1);
+		luaL_argcheck(L, cpu >= 0 && cpu <= 0xffff, 1, "cpu out of range");
+		cpus.push_back((int)cpu);
+	}
+
+	net::affinity::set_io_cpus(cpus);
+	return 0;
+}
+
+// the frame as shared slabs, which any number of io threads may write at once.
+static net::slab_buffer::ptr broadcast_slabs(const net::tcp_session::buffer_ptr& frame)
+{
+	std::vector<uint8_t>& raw = frame->getRawBuf();
+	net::slab_buffer::ptr slabs(new net::slab_buffer());
+	slabs->append(raw.data(), (uint32_t)raw.size());
+	return slabs;
+}
+
+// net.broadcast(clients, payload[, format]) frames payload once per framing in use, as
+// a "raw" string or encoded "packed" or "json", and queues that one buffer on every
+// connected client. Each session has its own io thread, so this is one post per
+// session either way.
+static int net_broadcast(lua_State* L)
+{
+	static const char* const formats[] = { "raw", "packed", "json", NULL };
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	luaL_checkany(L, 2);
+	int format = luaL_checkoption(L, 3, "raw", formats);
+
+	lua_Integer count = luaL_len(L, 1);
+	std::vector<net::tcp_client*> clients;
+	clients.reserve((size_t)count);
+	for (lua_Integer i = 1; i <= count; i++) {
+		lua_rawgeti(L, 1, i);
+		net::tcp_client* client = net_tcp_client_test(L, -1);
+		lua_pop(L, 1);
+		if (client == NULL) {
+			return luaL_error(L, "broadcast: clients[%d] is not a tcp client", (int)i);
+		}
+		clients.push_back(client);
+	}
+
+	if (clients.empty()) {
+		lua_pushinteger(L, 0);
+		return 1;
+	}
+
+	// one frame per framing: rpc clients need the push id in front of the payload.
+	net::tcp_session::buffer_ptr frames[2];
+	for (int rpc = 0; rpc < 2; rpc++) {
+		bool used = false;
+		for (size_t i = 0; i < clients.size() && !used; i++) {
+			used = clients[i]->data().rpc_enabled() == (rpc != 0);
+		}
+		if (!used) {
+			continue;
+		}
+
+		std::string error;
+		if (format == 0) {
+			size_t len = 0;
+			const char* payload = luaL_checklstring(L, 2, &len);
+			frames[rpc] = net::tcp_client_data::frame_raw(payload, len, rpc != 0);
+		}
+		else if (format == 1) {
+			frames[rpc] = net::tcp_client_data::frame_packed(L, 2, rpc != 0, error);
+		}
+		else {
+			frames[rpc] = net::tcp_client_data::frame_json(L, 2, rpc != 0, error);
+		}
+		if (!frames[rpc]) {
+			return luaL_error(L, "broadcast: %s", error.c_str());
+		}
+	}
+
+	// sessions with compression share one compressed copy per distinct setting.
+	struct variant {
+		bool rpc;
+		uint32_t threshold;
+		uint32_t header_length;
+		net::slab_buffer::ptr frame;
+	};
+	std::vector<variant> variants;
+
+	lua_Integer queued = 0;
+	for (size_t i = 0; i < clients.size(); i++) {
+		net::tcp_session& session = clients[i]->session();
+		if (session.io_service_stopped()) {
+			continue;
+		}
+
+		net::tcp_session_data& data = session.data();
+		bool rpc = clients[i]->data().rpc_enabled();
+		uint32_t threshold = data.compress_threshold();
+		uint32_t header_length = threshold != 0 ? data.read_skip_length() : 0;
+
+		size_t v = 0;
+		while (v < variants.size()
+			&& (variants[v].rpc != rpc || variants[v].threshold != threshold || variants[v].header_length != header_length)) {
+			v++;
+		}
+		if (v == variants.size()) {
+			const net::tcp_session::buffer_ptr& frame = frames[rpc ? 1 : 0];
+			variant added = { rpc, threshold, header_length,
+				broadcast_slabs(threshold != 0 ? session.compress_frame(frame) : frame) };
+			variants.push_back(added);
+		}
+
+		session.send(variants[v].frame);
+		queued++;
+	}
+
+	lua_pushinteger(L, queued);
+	return 1;
+}
+
+static const luaL_Reg net_lib_f[] = {
+	{ "setGcBudget", net_setGcBudget },
+	{ "gcStep", net_gcStep },
+	{ "gcStats", net_gcStats },
+	{ "setSessionPoolSize", net_setSessionPoolSize },
+	{ "broadcast", net_broadcast },
+	{ "pinLuaThread", net_pinLuaThread },
+	{ "setIoCpus", net_setIoCpus },
+	{ NULL, NULL },
+};
+
+int luaopen_net(lua_State* L)
+{
+	luaL_newlib(L, net_lib_f);
+	return 1;
+}
+
+int register_net(lua_State* L)
+{
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "preload");
+
+	lua_pushcfunction(L, luaopen_net);
+	lua_setfield(L, -2, packageName);
+
+	lua_pop(L, 2);
+
+	return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef __NET_REG_H__
+#define __NET_REG_H__
+
+#include "lua.hpp"
+
+extern int register_net(lua_State* L);
+
+#endif // !__NET_REG_H__
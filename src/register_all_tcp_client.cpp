@@ -1,11 +1,19 @@
 #include "register_all_tcp_client.h"
+#include "net_reg.h"
 #include "byte_buffer_reg.h"
+#include "codec/codec_reg.h"
 #include "tcp/tcp_client_reg.h"
+#include "tcp/rpc_reg.h"
+#include "tcp/tcp_pool_reg.h"
 
 int register_all_tcp_client(lua_State* L)
 {
+	register_net(L);
 	register_byte_buffer(L);
+	register_net_codec(L);
 	register_net_tcp_client(L);
+	register_net_rpc(L);
+	register_net_tcp_pool(L);
 
 	return 0;
 }
\ No newline at end of file
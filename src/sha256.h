@@ -0,0 +1,24 @@
+#ifndef __SHA256_H__
+#define __SHA256_H__
+
+
+#include <cstddef>
+#include <cstdint>
+
+
+// SHA-256 (FIPS 180-4), fed in pieces.
+struct sha256_state {
+	uint32_t h[8];
+	uint64_t length; // bytes fed so far
+	uint8_t block[64];
+	size_t used; // bytes waiting in block
+};
+
+static const size_t sha256_digest_size = 32;
+
+extern void sha256_init(sha256_state* s);
+extern void sha256_update(sha256_state* s, const void* data, size_t len);
+extern void sha256_final(sha256_state* s, uint8_t digest[sha256_digest_size]);
+
+
+#endif // !__SHA256_H__
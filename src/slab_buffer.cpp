@@ -0,0 +1,236 @@
+#include "slab_buffer.h"
+#include "thread_affinity.h"
+#include <boost/thread/mutex.hpp>
+#include <atomic>
+#include <cstring>
+#include <new>
+
+namespace net {
+
+	namespace {
+
+		// nodes beyond this share free lists.
+		const int max_nodes = 8;
+
+		// in front of every slab, names the node whose free list it goes back to.
+		// Padded so the slab after it keeps the alignment operator new gave the block.
+		union block_header {
+			int node;
+			std::max_align_t align;
+		};
+
+		// kept in the body of a free slab, the header stays valid.
+		struct free_slab {
+			free_slab* next;
+		};
+
+		struct slab_pool {
+			boost::mutex mutex;
+			free_slab* head;
+			size_t count;
+
+			slab_pool() : head(nullptr), count(0) {}
+		};
+
+		// one free list per NUMA node. A slab is first written by the thread that
+		// allocates it, which puts its pages on that thread's node, and it is only
+		// recycled to threads on the same node.
+		slab_pool& pool(int node)
+		{
+			static slab_pool instances[max_nodes];
+			return instances[node];
+		}
+
+		std::atomic<size_t> pool_capacity(1024); // slabs per node
+
+		block_header* header_of(void* pointer)
+		{
+			return static_cast<block_header*>(pointer) - 1;
+		}
+	}
+
+	void* slab::operator new(std::size_t size)
+	{
+		int node = affinity::current_node() % max_nodes;
+		slab_pool& p = pool(node);
+		{
+			boost::mutex::scoped_lock lock(p.mutex);
+			if (p.head != nullptr) {
+				free_slab* block = p.head;
+				p.head = block->next;
+				p.count--;
+				return block;
+			}
+		}
+
+		block_header* header = static_cast<block_header*>(::operator new(sizeof(block_header) + size));
+		header->node = node;
+		return header + 1;
+	}
+
+	void slab::operator delete(void* pointer)
+	{
+		slab_pool& p = pool(header_of(pointer)->node);
+		{
+			boost::mutex::scoped_lock lock(p.mutex);
+			if (p.count < pool_capacity) {
+				free_slab* block = static_cast<free_slab*>(pointer);
+				block->next = p.head;
+				p.head = block;
+				p.count++;
+				return;
+			}
+		}
+		::operator delete(header_of(pointer));
+	}
+
+	void slab::set_pool_capacity(size_t slabs)
+	{
+		pool_capacity = slabs;
+		for (int node = 0; node < max_nodes; node++) {
+			slab_pool& p = pool(node);
+			free_slab* drop = nullptr;
+			{
+				boost::mutex::scoped_lock lock(p.mutex);
+				while (p.count > slabs) {
+					free_slab* block = p.head;
+					p.head = block->next;
+					p.count--;
+					block->next = drop;
+					drop = block;
+				}
+			}
+			while (drop != nullptr) {
+				free_slab* next = drop->next;
+				::operator delete(header_of(drop));
+				drop = next;
+			}
+		}
+	}
+
+	size_t slab::pooled()
+	{
+		size_t count = 0;
+		for (int node = 0; node < max_nodes; node++) {
+			slab_pool& p = pool(node);
+			boost::mutex::scoped_lock lock(p.mutex);
+			count += p.count;
+		}
+		return count;
+	}
+
+	slab_buffer::slab_buffer()
+		:m_size(0)
+		,m_tail_fill(0)
+	{
+	}
+
+	void slab_buffer::append(const uint8_t* data, uint32_t len)
+	{
+		while (len > 0) {
+			if (m_tail_fill == 0 || m_tail_fill == slab::capacity) {
+				slice s = { boost::intrusive_ptr<slab>(new slab()), 0, 0 };
+				m_slices.push_back(s);
+				m_tail_fill = 0;
+			}
+
+			slice& tail = m_slices.back();
+			uint32_t n = slab::capacity - m_tail_fill;
+			if (n > len) {
+				n = len;
+			}
+
+			memcpy(tail.block->data() + m_tail_fill, data, n);
+			tail.length += n;
+			m_tail_fill += n;
+			m_size += n;
+			data += n;
+			len -= n;
+		}
+	}
+
+	void slab_buffer::append(const slab_buffer& other, uint32_t offset, uint32_t len)
+	{
+		if (offset >= other.m_size || len == 0) {
+			return;
+		}
+		if (len > other.m_size - offset) {
+			len = other.m_size - offset;
+		}
+
+		// nothing may be written behind the shared slices.
+		m_tail_fill = 0;
+
+		// walk other's slices by value, other may be this buffer.
+		size_t count = other.m_slices.size();
+		for (size_t i = 0; i < count && len > 0; i++) {
+			slice s = other.m_slices[i];
+			if (offset >= s.length) {
+				offset -= s.length;
+				continue;
+			}
+
+			s.offset += offset;
+			s.length -= offset;
+			offset = 0;
+			if (s.length > len) {
+				s.length = len;
+			}
+
+			len -= s.length;
+			m_size += s.length;
+			m_slices.push_back(s);
+		}
+	}
+
+	void slab_buffer::append(const slab_buffer& other)
+	{
+		append(other, 0, other.m_size);
+	}
+
+	slab_buffer::ptr slab_buffer::slice_of(uint32_t offset, uint32_t len) const
+	{
+		ptr view(new slab_buffer());
+		view->append(*this, offset, len);
+		return view;
+	}
+
+	uint32_t slab_buffer::copy_to(uint8_t* dst, uint32_t offset, uint32_t len) const
+	{
+		uint32_t copied = 0;
+		for (size_t i = 0; i < m_slices.size() && copied < len; i++) {
+			const slice& s = m_slices[i];
+			if (offset >= s.length) {
+				offset -= s.length;
+				continue;
+			}
+
+			uint32_t n = s.length - offset;
+			if (n > len - copied) {
+				n = len - copied;
+			}
+			memcpy(dst + copied, s.block->data() + s.offset + offset, n);
+			copied += n;
+			offset = 0;
+		}
+		return copied;
+	}
+
+	std::vector<boost::asio::const_buffer> slab_buffer::buffers() const
+	{
+		std::vector<boost::asio::const_buffer> out;
+		out.reserve(m_slices.size());
+		for (size_t i = 0; i < m_slices.size(); i++) {
+			const slice& s = m_slices[i];
+			out.push_back(boost::asio::const_buffer(s.block->data() + s.offset, s.length));
+		}
+		return out;
+	}
+
+	void slab_buffer::clear()
+	{
+		m_slices.clear();
+		m_size = 0;
+		m_tail_fill = 0;
+	}
+}; // namespace net
@@ -0,0 +1,87 @@
+#ifndef __SLAB_BUFFER_H__
+#define __SLAB_BUFFER_H__
+
+#include <boost/asio/buffer.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace net {
+
+	// A fixed 4 KiB block, recycled through its NUMA node's free list when the last
+	// slice referring to it goes away (possibly on another thread).
+	class slab
+		: public boost::intrusive_ref_counter<slab>
+	{
+	public:
+		static const uint32_t capacity = 4096;
+
+		uint8_t* data() { return m_data; }
+		const uint8_t* data() const { return m_data; }
+
+		static void* operator new(std::size_t size);
+		static void operator delete(void* pointer);
+
+		// slabs kept on each node's free list at most, the rest go back to the heap.
+		static void set_pool_capacity(size_t slabs);
+		static size_t pooled();
+
+	private:
+		uint8_t m_data[capacity];
+	};
+
+	// A rope of refcounted slab slices. Slicing, appending another buffer and sending
+	// share the slabs instead of copying bytes, so a payload can be split into frames,
+	// forwarded or handed to many sessions while it is written once.
+	// Contents are immutable once appended; a buffer is not safe for concurrent use,
+	// the slabs it shares are.
+	class slab_buffer
+		: public boost::intrusive_ref_counter<slab_buffer>
+	{
+	public:
+		typedef boost::intrusive_ptr<slab_buffer> ptr;
+
+		struct slice {
+			boost::intrusive_ptr<slab> block;
+			uint32_t offset;
+			uint32_t length;
+		};
+
+	public:
+		slab_buffer();
+
+		uint32_t size() const { return m_size; }
+		bool empty() const { return m_size == 0; }
+		const std::vector<slice>& slices() const { return m_slices; }
+
+		// copy bytes in, filling the last slab this buffer wrote before taking new ones.
+		void append(const uint8_t* data, uint32_t len);
+
+		// share len bytes of other starting at offset, no bytes are copied.
+		void append(const slab_buffer& other, uint32_t offset, uint32_t len);
+		void append(const slab_buffer& other);
+
+		// a new buffer sharing len bytes from offset.
+		ptr slice_of(uint32_t offset, uint32_t len) const;
+
+		// copy out len bytes from offset, returns the number copied.
+		uint32_t copy_to(uint8_t* dst, uint32_t offset, uint32_t len) const;
+
+		// one asio buffer per slice, for gather writes.
+		std::vector<boost::asio::const_buffer> buffers() const;
+
+		void clear();
+
+	private:
+		std::vector<slice> m_slices;
+		uint32_t m_size;
+
+		// bytes used in the last slab if this buffer allocated it, 0 otherwise.
+		// Views handed out never cover the unused part, so it is safe to keep writing.
+		uint32_t m_tail_fill;
+	};
+}; // namespace net
+
+#endif //__SLAB_BUFFER_H__
@@ -0,0 +1,127 @@
+#ifndef __HANDLER_MEMORY_H__
+#define __HANDLER_MEMORY_H__
+
+#include <boost/noncopyable.hpp>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace net {
+
+	// In-place memory for the one outstanding operation of a kind (a session's read,
+	// write or timer wait), handed to asio through the handler's associated allocator.
+	// Falls back to the heap if the block is busy or too small.
+	class handler_memory
+		: private boost::noncopyable
+	{
+	public:
+		handler_memory()
+			:m_in_use(false)
+		{
+		}
+
+		void* allocate(std::size_t size)
+		{
+			if (!m_in_use && size <= sizeof(m_storage)) {
+				m_in_use = true;
+				return &m_storage;
+			}
+			return ::operator new(size);
+		}
+
+		void deallocate(void* pointer)
+		{
+			if (pointer == &m_storage) {
+				m_in_use = false;
+			}
+			else {
+				::operator delete(pointer);
+			}
+		}
+
+	private:
+		typename std::aligned_storage<512>::type m_storage;
+		bool m_in_use;
+	};
+
+	template <typename T>
+	class handler_allocator
+	{
+	public:
+		typedef T value_type;
+
+		explicit handler_allocator(handler_memory& memory)
+			:m_memory(memory)
+		{
+		}
+
+		template <typename U>
+		handler_allocator(const handler_allocator<U>& other)
+			:m_memory(other.m_memory)
+		{
+		}
+
+		bool operator==(const handler_allocator& other) const
+		{
+			return &m_memory == &other.m_memory;
+		}
+
+		bool operator!=(const handler_allocator& other) const
+		{
+			return &m_memory != &other.m_memory;
+		}
+
+		T* allocate(std::size_t n) const
+		{
+			return static_cast<T*>(m_memory.allocate(sizeof(T) * n));
+		}
+
+		void deallocate(T* p, std::size_t n) const
+		{
+			(void)n;
+			m_memory.deallocate(p);
+		}
+
+	private:
+		template <typename> friend class handler_allocator;
+
+		handler_memory& m_memory;
+	};
+
+	template <typename Handler>
+	class custom_alloc_handler
+	{
+	public:
+		typedef handler_allocator<Handler> allocator_type;
+
+		custom_alloc_handler(handler_memory& memory, Handler handler)
+			:m_memory(memory)
+			,m_handler(handler)
+		{
+		}
+
+		allocator_type get_allocator() const
+		{
+			return allocator_type(m_memory);
+		}
+
+		template <typename... Args>
+		void operator()(Args&&... args)
+		{
+			m_handler(std::forward<Args>(args)...);
+		}
+
+	private:
+		handler_memory& m_memory;
+		Handler m_handler;
+	};
+
+	template <typename Handler>
+	inline custom_alloc_handler<Handler> make_custom_alloc_handler(handler_memory& memory, Handler handler)
+	{
+		return custom_alloc_handler<Handler>(memory, handler);
+	}
+}; // namespace net
+
+#endif //__HANDLER_MEMORY_H__
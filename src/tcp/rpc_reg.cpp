@@ -0,0 +1,140 @@
+#include "rpc_reg.h"
+#include "tcp_client_reg.h"
+#include "tcp_client.h"
+#include "tcp_client_data.h"
+#include "tcp_session_data.h"
+
+using namespace net;
+
+static const char* packageName = "net.rpc";
+
+static tcp_client* net_rpc_check_client(lua_State* L, int index)
+{
+	tcp_client* client = net_tcp_client_test(L, index);
+	if (client == NULL) {
+		luaL_argerror(L, index, "tcp client expected");
+	}
+	return client;
+}
+
+// rpc.enable(tcp) switches the client to rpc framing, before it connects.
+static int net_rpc_enable(lua_State* L)
+{
+	tcp_client* client = net_rpc_check_client(L, 1);
+	client->data().enable_rpc();
+	return 0;
+}
+
+// rpc.call(tcp, payload[, timeout_ms[, callback]])
+// With a callback it returns the request id and later calls callback(response, err).
+// Without one it must run in a coroutine, which waits and gets (response) or (nil, err).
+static int net_rpc_call(lua_State* L)
+{
+	tcp_client* client = net_rpc_check_client(L, 1);
+	size_t len = 0;
+	const char* payload = luaL_checklstring(L, 2, &len);
+	lua_Integer timeout = luaL_optinteger(L, 3, 0);
+	luaL_argcheck(L, timeout >= 0, 3, "timeout must not be negative");
+
+	bool has_callback = !lua_isnoneornil(L, 4);
+	if (has_callback) {
+		luaL_checktype(L, 4, LUA_TFUNCTION);
+	}
+	else if (!lua_isyieldable(L)) {
+		return luaL_error(L, "rpc.call outside a coroutine needs a callback");
+	}
+
+	tcp_client_data& data = client->data();
+	if (!data.rpc_enabled()) {
+		return luaL_error(L, "rpc is not enabled on this client");
+	}
+	if (client->session().io_service_stopped()) {
+		lua_pushnil(L);
+		lua_pushliteral(L, "not connected");
+		return 2;
+	}
+
+	data.release_call_refs(L);
+
+	rpc_table::call call;
+	uint32_t id = data.rpc().next_id();
+	call.id = id;
+	call.coroutine = !has_callback;
+	call.thread = has_callback ? NULL : L;
+	if (has_callback) {
+		lua_pushvalue(L, 4);
+	}
+	else {
+		lua_pushthread(L);
+	}
+	call.ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	if (timeout > 0) {
+		call.deadline = boost::asio::deadline_timer::traits_type::now() + boost::posix_time::milliseconds((long)timeout);
+	}
+	tcp_session::buffer_ptr frame = data.make_rpc_buf(id, payload, len);
+	if (data.rpc().admit(call, frame)) {
+		data.send_call(id, call.thread, frame);
+	}
+
+	if (timeout > 0) {
+		client->session().schedule_call_timer(call.deadline);
+	}
+
+	if (has_callback) {
+		lua_pushinteger(L, id);
+		return 1;
+	}
+	return lua_yield(L, 0);
+}
+
+// rpc.setWindow(tcp, n) keeps at most n calls on the wire, later ones wait their
+// turn in call order. 0 (the default) sends every call at once.
+static int net_rpc_set_window(lua_State* L)
+{
+	tcp_client* client = net_rpc_check_client(L, 1);
+	lua_Integer window = luaL_checkinteger(L, 2);
+	luaL_argcheck(L, window >= 0 && window <= 0xffffffff, 2, "window out of range");
+
+	client->data().rpc().set_window((uint32_t)window);
+	client->data().send_queued_calls();
+	return 0;
+}
+
+// rpc.pending(tcp) returns the calls waiting for an answer, and how many of them
+// are still queued behind the window.
+static int net_rpc_pending(lua_State* L)
+{
+	tcp_client* client = net_rpc_check_client(L, 1);
+	client->data().release_call_refs(L);
+	lua_pushinteger(L, (lua_Integer)client->data().rpc().size());
+	lua_pushinteger(L, (lua_Integer)client->data().rpc().queued());
+	return 2;
+}
+
+static const luaL_Reg rpc_lib_f[] = {
+	{ "enable", net_rpc_enable },
+	{ "call", net_rpc_call },
+	{ "setWindow", net_rpc_set_window },
+	{ "pending", net_rpc_pending },
+	{ NULL, NULL },
+};
+
+int luaopen_net_rpc(lua_State* L)
+{
+	luaL_newlib(L, rpc_lib_f);
+	return 1;
+}
+
+int register_net_rpc(lua_State* L)
+{
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "preload");
+
+	lua_pushcfunction(L, luaopen_net_rpc);
+	lua_setfield(L, -2, packageName);
+
+	lua_pop(L, 2);
+
+	return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef __RPC_REG_H__
+#define __RPC_REG_H__
+
+#include "lua.hpp"
+
+extern int register_net_rpc(lua_State* L);
+
+#endif // !__RPC_REG_H__
@@ -0,0 +1,278 @@
+#include "rpc_table.h"
+#include <algorithm>
+
+namespace net {
+
+	namespace {
+		const size_t initial_capacity = 16;
+		const int initial_shift = 28; // 32 - log2(initial_capacity)
+	}
+
+	rpc_table::rpc_table()
+		:m_slots(initial_capacity)
+		,m_count(0)
+		,m_shift(initial_shift)
+		,m_next_id(0)
+		,m_window(0)
+		,m_in_flight(0)
+	{
+		for (size_t i = 0; i < m_slots.size(); i++) {
+			m_slots[i].id = 0;
+		}
+	}
+
+	uint32_t rpc_table::next_id()
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		if (++m_next_id == 0) {
+			m_next_id = 1;
+		}
+		return m_next_id;
+	}
+
+	size_t rpc_table::home(uint32_t id) const
+	{
+		// fibonacci hashing spreads sequential ids over the whole table.
+		return (size_t)((uint32_t)(id * 2654435769U) >> m_shift);
+	}
+
+	size_t rpc_table::find(uint32_t id) const
+	{
+		size_t mask = m_slots.size() - 1;
+		for (size_t i = home(id); ; i = (i + 1) & mask) {
+			if (m_slots[i].id == id || m_slots[i].id == 0) {
+				return i;
+			}
+		}
+	}
+
+	void rpc_table::insert(const call& c)
+	{
+		if ((m_count + 1) * 2 > m_slots.size()) {
+			grow();
+		}
+
+		size_t i = find(c.id);
+		if (m_slots[i].id == 0) {
+			m_count++;
+		}
+		m_slots[i] = c;
+
+		if (!c.deadline.is_not_a_date_time()) {
+			m_timeouts.push_back(timeout(c.deadline, c.id));
+			std::push_heap(m_timeouts.begin(), m_timeouts.end(), later());
+
+			// answered calls leave their deadline behind, rebuild before they pile up.
+			if (m_timeouts.size() > 2 * m_count + 64) {
+				m_timeouts.clear();
+				for (size_t s = 0; s < m_slots.size(); s++) {
+					if (m_slots[s].id != 0 && !m_slots[s].deadline.is_not_a_date_time()) {
+						m_timeouts.push_back(timeout(m_slots[s].deadline, m_slots[s].id));
+					}
+				}
+				std::make_heap(m_timeouts.begin(), m_timeouts.end(), later());
+			}
+		}
+	}
+
+	bool rpc_table::admit(call& c, const frame_ptr& frame)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		c.sent = m_queue.empty() && window_open();
+		if (c.sent) {
+			m_in_flight++;
+		}
+		else {
+			m_queue.push_back(std::make_pair(c.id, frame));
+		}
+		insert(c);
+		return c.sent;
+	}
+
+	void rpc_table::take_sendable(std::vector<frame_ptr>& out)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		while (!m_queue.empty() && window_open()) {
+			size_t i = find(m_queue.front().first);
+			if (m_slots[i].id != 0) {
+				m_slots[i].sent = true;
+				m_in_flight++;
+				out.push_back(m_queue.front().second);
+			}
+			m_queue.pop_front();
+		}
+	}
+
+	void rpc_table::set_window(uint32_t window)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_window = window;
+	}
+
+	uint32_t rpc_table::window()
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		return m_window;
+	}
+
+	uint32_t rpc_table::in_flight()
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		return m_in_flight;
+	}
+
+	size_t rpc_table::queued()
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		return m_count - m_in_flight;
+	}
+
+	bool rpc_table::contains(uint32_t id)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		return id != 0 && m_slots[find(id)].id != 0;
+	}
+
+	bool rpc_table::take(uint32_t id, call& out)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		if (id == 0) {
+			return false;
+		}
+
+		size_t i = find(id);
+		if (m_slots[i].id == 0) {
+			return false;
+		}
+
+		out = m_slots[i];
+		forget(out);
+		erase_slot(i);
+		return true;
+	}
+
+	void rpc_table::expire(const boost::posix_time::ptime& now, std::vector<call>& out)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		while (!m_timeouts.empty() && m_timeouts.front().first <= now) {
+			uint32_t id = m_timeouts.front().second;
+			std::pop_heap(m_timeouts.begin(), m_timeouts.end(), later());
+			m_timeouts.pop_back();
+
+			size_t i = find(id);
+			if (m_slots[i].id != 0) {
+				out.push_back(m_slots[i]);
+				forget(m_slots[i]);
+				erase_slot(i);
+			}
+		}
+	}
+
+	void rpc_table::take_all(std::vector<call>& out)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		for (size_t i = 0; i < m_slots.size(); i++) {
+			if (m_slots[i].id != 0) {
+				out.push_back(m_slots[i]);
+				m_slots[i].id = 0;
+			}
+		}
+		m_count = 0;
+		m_timeouts.clear();
+		m_in_flight = 0;
+		m_queue.clear();
+	}
+
+	boost::posix_time::ptime rpc_table::next_deadline()
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		drop_stale_timeouts();
+		if (m_timeouts.empty()) {
+			return boost::posix_time::ptime(boost::posix_time::not_a_date_time);
+		}
+		return m_timeouts.front().first;
+	}
+
+	size_t rpc_table::size()
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		return m_count;
+	}
+
+	void rpc_table::release_ref(int ref)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_released_refs.push_back(ref);
+	}
+
+	void rpc_table::take_released_refs(std::vector<int>& out)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		out.insert(out.end(), m_released_refs.begin(), m_released_refs.end());
+		m_released_refs.clear();
+	}
+
+	void rpc_table::erase_slot(size_t index)
+	{
+		size_t mask = m_slots.size() - 1;
+
+		// pull later members of the probe run back over the hole, so lookups never
+		// need tombstones.
+		for (size_t j = (index + 1) & mask; m_slots[j].id != 0; j = (j + 1) & mask) {
+			size_t k = home(m_slots[j].id);
+			bool stays = (index <= j) ? (index < k && k <= j) : (index < k || k <= j);
+			if (!stays) {
+				m_slots[index] = m_slots[j];
+				index = j;
+			}
+		}
+
+		m_slots[index].id = 0;
+		m_count--;
+	}
+
+	void rpc_table::grow()
+	{
+		std::vector<call> old;
+		old.swap(m_slots);
+
+		m_slots.resize(old.size() * 2);
+		for (size_t i = 0; i < m_slots.size(); i++) {
+			m_slots[i].id = 0;
+		}
+		m_shift--;
+
+		for (size_t i = 0; i < old.size(); i++) {
+			if (old[i].id != 0) {
+				m_slots[find(old[i].id)] = old[i];
+			}
+		}
+	}
+
+	void rpc_table::forget(const call& c)
+	{
+		// a queued frame stays behind and is skipped once its turn comes.
+		if (c.sent) {
+			m_in_flight--;
+		}
+	}
+
+	bool rpc_table::window_open() const
+	{
+		return m_window == 0 || m_in_flight < m_window;
+	}
+
+	void rpc_table::drop_stale_timeouts()
+	{
+		while (!m_timeouts.empty() && m_slots[find(m_timeouts.front().second)].id == 0) {
+			std::pop_heap(m_timeouts.begin(), m_timeouts.end(), later());
+			m_timeouts.pop_back();
+		}
+	}
+}; // namespace net
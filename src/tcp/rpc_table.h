@@ -0,0 +1,112 @@
+#ifndef __RPC_TABLE_H__
+#define __RPC_TABLE_H__
+
+#include "../byte_buffer.h"
+#include "lua.hpp"
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <utility>
+#include <vector>
+
+namespace net {
+
+	// Calls waiting for a response, keyed by request id in an open addressing table
+	// (linear probing, backward shift deletion), plus a min-heap of their deadlines
+	// that drives the session's single call timer. Calls are added on the Lua thread
+	// and completed on the io thread, hence the lock.
+	// With a window set, at most that many calls are on the wire; the rest wait in
+	// order with their frames and go out as answers come back.
+	class rpc_table
+		: private boost::noncopyable
+	{
+	public:
+		typedef boost::intrusive_ptr<byte_buffer> frame_ptr;
+
+		struct call {
+			uint32_t id;        // never 0, which marks an empty slot
+			int ref;            // registry ref of the callback or the waiting coroutine
+			bool coroutine;
+			lua_State* thread;  // the waiting coroutine, null for a callback
+			bool sent;          // counted in the window
+			boost::posix_time::ptime deadline; // not_a_date_time for no timeout
+		};
+
+	public:
+		rpc_table();
+
+		// next request id, skipping 0.
+		uint32_t next_id();
+
+		// add the call, true if its frame may be sent now. Otherwise the frame is queued
+		// until take_sendable hands it out.
+		bool admit(call& c, const frame_ptr& frame);
+
+		// queued frames that fit in the window now, oldest first. Calls that timed
+		// out while waiting are skipped.
+		void take_sendable(std::vector<frame_ptr>& out);
+
+		// 0 for no limit.
+		void set_window(uint32_t window);
+		uint32_t window();
+		uint32_t in_flight();
+		size_t queued();
+
+		// false once the call with id has been answered or timed out.
+		bool contains(uint32_t id);
+
+		// remove the call with id, false if there is none (answered or timed out already).
+		bool take(uint32_t id, call& out);
+
+		// remove the calls whose deadline is at or before now.
+		void expire(const boost::posix_time::ptime& now, std::vector<call>& out);
+
+		// remove every call.
+		void take_all(std::vector<call>& out);
+
+		// earliest deadline of a pending call, not_a_date_time if none has one.
+		boost::posix_time::ptime next_deadline();
+
+		size_t size();
+
+		// registry refs of completed calls. They are released on the Lua thread, so the
+		// io thread never writes to the registry while the script may be using it.
+		void release_ref(int ref);
+		void take_released_refs(std::vector<int>& out);
+
+	private:
+		typedef std::pair<boost::posix_time::ptime, uint32_t> timeout;
+
+		struct later {
+			bool operator()(const timeout& a, const timeout& b) const { return a.first > b.first; }
+		};
+
+		size_t home(uint32_t id) const;
+		size_t find(uint32_t id) const;
+		void insert(const call& c);
+		void erase_slot(size_t index);
+		void grow();
+		void drop_stale_timeouts();
+		void forget(const call& c);
+		bool window_open() const;
+
+	private:
+		boost::mutex m_mutex;
+		std::vector<call> m_slots; // power of two, at most half full
+		size_t m_count;
+		int m_shift;
+		std::vector<timeout> m_timeouts; // entries of completed calls are dropped lazily
+		std::vector<int> m_released_refs;
+		uint32_t m_next_id;
+
+		uint32_t m_window;
+		uint32_t m_in_flight;
+		std::deque<std::pair<uint32_t, frame_ptr> > m_queue;
+	};
+}; // namespace net
+
+#endif //__RPC_TABLE_H__
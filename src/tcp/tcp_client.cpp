@@ -1,6 +1,7 @@
 #include "tcp_client.h"
 #include "tcp_client_data.h"
 #include "tcp_session_data.h"
+#include "tcp_session_pool.h"
 #include <boost/bind.hpp>
 #include <boost/bind/placeholders.hpp>
 #include <iostream>
@@ -8,20 +9,41 @@
 
 namespace net {
 	tcp_client::tcp_client()
-		:m_data(new tcp_client_data())
-		,m_session(new tcp_session())
 	{
+		if (tcp_session_pool::instance().acquire(m_session, m_data)) {
+			m_session->data().reset();
+		}
+		else {
+			m_data.reset(new tcp_client_data());
+			m_session.reset(new tcp_session());
+			wire_session();
+		}
+
 		m_session->data()
 			.read_timeout(60)
 			.heartbeat_interval(3)
-			.heartbeat_buffer(m_data->make_heartbeat_buf())
 			.magic_key(0)
 			.header_length(4)
 			.read_skip_length(4)
-			.on_message_handler(std::bind(&tcp_client_data::on_message, m_data->shared_from_this(), std::placeholders::_1))
-			.on_connected_handler(std::bind(&tcp_client_data::on_connected, m_data->shared_from_this(), std::placeholders::_1))
-			.on_closed_handler(std::bind(&tcp_client_data::on_closed, m_data->shared_from_this()))
-			.on_error_handler(std::bind(&tcp_client_data::on_error, m_data->shared_from_this(), std::placeholders::_1))
+			.compress_threshold(0)
+			.heartbeat_buffer(tcp_client_data::default_heartbeat_buf(false))
+			.socket_options(tcp_session::socket_options())
+			.io_options(tcp_session::io_options())
+			.read_buffer_limit(m_session->data().cache_size() * 8)
+			.read_drain(false)
+			;
+	}
+
+	void tcp_client::wire_session()
+	{
+		m_data->attach(m_session.get());
+		m_session->data()
+			.on_message_handler(std::bind(&tcp_client_data::on_message, tcp_client_data::ptr(m_data), std::placeholders::_1))
+			.on_frame_handler(std::bind(&tcp_client_data::on_frame, tcp_client_data::ptr(m_data), std::placeholders::_1, std::placeholders::_2))
+			.on_connected_handler(std::bind(&tcp_client_data::on_connected, tcp_client_data::ptr(m_data), std::placeholders::_1))
+			.on_closed_handler(std::bind(&tcp_client_data::on_closed, tcp_client_data::ptr(m_data)))
+			.on_error_handler(std::bind(&tcp_client_data::on_error, tcp_client_data::ptr(m_data), std::placeholders::_1))
+			.on_call_timer_handler(std::bind(&tcp_client_data::on_call_timer, tcp_client_data::ptr(m_data)))
 			;
 	}
 
@@ -37,7 +59,17 @@ namespace net {
 			m_session->close();
 		}
 
-		// now m_session's life is holded by m_session's io_service.
+		// the io thread may be inside a handler calling into Lua with these references,
+		// so they are dropped once it has returned. Closing lets it return soon.
+		m_session->wait_io_threads();
+
+		// the lua references belong to this client, drop them before the state is reused.
+		m_data->reset();
+
+		// the session is handed out again once m_session's io_service released it.
+		tcp_session_pool::instance().release(m_session, m_data);
+
+		// now m_session's life is holded by m_session's io_service and the pool.
 		m_session.reset();
 
 		// now m_data's life is holded by m_session.
@@ -71,6 +103,18 @@ namespace net {
 		return *this;
 	}
 
+	tcp_client& tcp_client::send(const boost::intrusive_ptr<byte_buffer>& frame)
+	{
+		m_session->send(frame);
+		return *this;
+	}
+
+	tcp_client& tcp_client::send(const boost::intrusive_ptr<slab_buffer>& frame)
+	{
+		m_session->send(frame);
+		return *this;
+	}
+
 	tcp_client& tcp_client::close()
 	{
 		m_session->close();
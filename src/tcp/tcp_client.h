@@ -1,7 +1,11 @@
 #ifndef __TCP_CLIENT_H__
 #define __TCP_CLIENT_H__
 
-#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <string>
+#include "../byte_buffer.h"
+#include "../slab_buffer.h"
 
 namespace net {
 
@@ -9,18 +13,18 @@ namespace net {
 	class tcp_client_data;
 	class tcp_session_data;
 
+	// Constructed in place inside its Lua userdata block. Asio handlers never point
+	// at the client, only at the refcounted session and client data it owns.
 	class tcp_client
-		: public boost::enable_shared_from_this<tcp_client>
 	{
-	public:
-		typedef boost::shared_ptr<tcp_client>  ptr;
-
 	public:
 		virtual tcp_client& connect(std::string host, uint32_t port);
 		virtual tcp_client& connect();
 
 		virtual tcp_client& send(std::string json);
 		virtual tcp_client& send(const char* jsonp, size_t len);
+		virtual tcp_client& send(const boost::intrusive_ptr<byte_buffer>& frame); // already framed
+		virtual tcp_client& send(const boost::intrusive_ptr<slab_buffer>& frame); // already framed, shared
 
 		virtual tcp_client& close();
 
@@ -34,8 +38,11 @@ namespace net {
 		virtual ~tcp_client();
 
 	protected:
-		boost::shared_ptr<tcp_session>  m_session;
-		boost::shared_ptr<tcp_client_data> m_data;
+		void wire_session();
+
+	protected:
+		boost::intrusive_ptr<tcp_session>  m_session;
+		boost::intrusive_ptr<tcp_client_data> m_data;
 	};
 };
 
@@ -1,15 +1,51 @@
 #include "tcp_client_data.h"
 #include "tcp_session_data.h"
 #include "../lua_util.h"
+#include "../codec/msgpack_codec.h"
+#include "../codec/json_codec.h"
 
 
 namespace net {
 
+	namespace {
+		const char default_heartbeat_payload[] = "heartbeat";
+
+		// what on_frame hands to decode_and_call.
+		struct frame_call {
+			const uint8_t* data;
+			uint32_t size;
+			bool json;
+			std::string* error; // set if the frame does not decode
+		};
+
+		// [frame_call] [handler]: decode the frame and call the handler with the value.
+		// Runs under lua_pcall, so running out of memory while the value is built is a
+		// Lua error instead of a panic. Lua unwinds with longjmp: nothing on this frame
+		// may need a destructor.
+		int decode_and_call(lua_State* L)
+		{
+			frame_call* call = static_cast<frame_call*>(lua_touserdata(L, 1));
+			bool decoded = call->json
+				? json_codec::decode(L, call->data, call->size, *call->error)
+				: msgpack_codec::decode(L, call->data, call->size, *call->error) != 0;
+			if (decoded) {
+				lua_call(L, 1, 0);
+			}
+			return 0;
+		}
+	}
+
 	tcp_client_data::tcp_client_data()
 		: m_on_message_ref(LUA_REFNIL)
+		, m_on_packed_ref(LUA_REFNIL)
+		, m_on_json_ref(LUA_REFNIL)
 		, m_on_connected_ref(LUA_REFNIL)
 		, m_on_closed_ref(LUA_REFNIL)
 		, m_on_error_ref(LUA_REFNIL)
+		, m_lua_state(nullptr)
+		, m_session(nullptr)
+		, m_rpc_enabled(false)
+		, m_heartbeat_payload(default_heartbeat_payload, sizeof(default_heartbeat_payload))
 	{
 
 	}
@@ -18,12 +54,31 @@ namespace net {
 	{
 		std::cout << "tcp client data destructed." << std::endl;
 
+		reset();
+	}
+
+	void tcp_client_data::reset()
+	{
 		lua_State* L = m_lua_state;
 
+		// nobody is left to answer, just let go of the callers.
+		std::vector<rpc_table::call> calls;
+		m_rpc.take_all(calls);
+
 		if (L) {
+			for (size_t i = 0; i < calls.size(); i++) {
+				luaL_unref(L, LUA_REGISTRYINDEX, calls[i].ref);
+			}
+			release_call_refs(L);
 			if (m_on_message_ref != LUA_REFNIL) {
 				luautil_unref_function(L, m_on_message_ref);
 			}
+			if (m_on_packed_ref != LUA_REFNIL) {
+				luautil_unref_function(L, m_on_packed_ref);
+			}
+			if (m_on_json_ref != LUA_REFNIL) {
+				luautil_unref_function(L, m_on_json_ref);
+			}
 			if (m_on_connected_ref != LUA_REFNIL) {
 				luautil_unref_function(L, m_on_connected_ref);
 			}
@@ -34,39 +89,346 @@ namespace net {
 				luautil_unref_function(L, m_on_error_ref);
 			}
 		}
+
+		m_on_message_ref = LUA_REFNIL;
+		m_on_packed_ref = LUA_REFNIL;
+		m_on_json_ref = LUA_REFNIL;
+		m_on_connected_ref = LUA_REFNIL;
+		m_on_closed_ref = LUA_REFNIL;
+		m_on_error_ref = LUA_REFNIL;
+		m_lua_state = nullptr;
+		m_rpc_enabled = false;
+		m_heartbeat_payload.assign(default_heartbeat_payload, sizeof(default_heartbeat_payload));
 	}
 
-	tcp_session::buffer_ptr tcp_client_data::make_buf(const char* jsonp, size_t len)
+	tcp_session::buffer_ptr tcp_client_data::frame_raw(const char* payload, size_t len, bool rpc)
 	{
+		if (rpc) {
+			return make_rpc_buf(0, payload, len);
+		}
+
 		tcp_session::buffer_ptr buf(new tcp_session::buffer_type(4 + len));
 
 		buf->putInt(4 + len);
-		buf->putBytes((uint8_t*)jsonp, len);
+		buf->putBytes((uint8_t*)payload, len);
 
 		return buf;
 	}
 
-	tcp_session::buffer_ptr tcp_client_data::make_buf(std::string& json)
+	tcp_session::buffer_ptr tcp_client_data::frame_packed(lua_State* L, int index, bool rpc, std::string& error)
 	{
-		tcp_session::buffer_ptr buf(new tcp_session::buffer_type(json.length() + 4));
+		tcp_session::buffer_ptr buf(new tcp_session::buffer_type(256));
+
+		// encode straight after the header, then fill in the length.
+		buf->putInt(0);
+		if (rpc) {
+			buf->putInt(0);
+		}
+		if (!msgpack_codec::encode(L, index, *buf, error)) {
+			return tcp_session::buffer_ptr();
+		}
 
-		buf->putInt(4 + json.length());
-		buf->putBytes((uint8_t*)json.data(), json.length());
+		uint32_t len = buf->getWritePos();
+		buf->putInt(len, 0);
+		buf->setWritePos(len);
 
 		return buf;
 	}
 
-	tcp_session::buffer_ptr tcp_client_data::make_heartbeat_buf()
+	tcp_session::buffer_ptr tcp_client_data::frame_json(lua_State* L, int index, bool rpc, std::string& error)
 	{
-		char hb[] = "heartbeat";
+		tcp_session::buffer_ptr buf(new tcp_session::buffer_type(256));
 
-		tcp_session::buffer_ptr buf(new tcp_session::buffer_type(4 + sizeof(hb)));
-		buf->putInt(4 + sizeof(hb));
-		buf->putBytes((uint8_t*)hb, sizeof(hb));
+		buf->putInt(0);
+		if (rpc) {
+			buf->putInt(0);
+		}
+		if (!json_codec::encode(L, index, *buf, error)) {
+			return tcp_session::buffer_ptr();
+		}
+
+		uint32_t len = buf->getWritePos();
+		buf->putInt(len, 0);
+		buf->setWritePos(len);
 
 		return buf;
 	}
 
+	const tcp_session::buffer_ptr& tcp_client_data::default_heartbeat_buf(bool rpc)
+	{
+		static const tcp_session::buffer_ptr plain = frame_raw(default_heartbeat_payload, sizeof(default_heartbeat_payload), false);
+		static const tcp_session::buffer_ptr push = frame_raw(default_heartbeat_payload, sizeof(default_heartbeat_payload), true);
+
+		return rpc ? push : plain;
+	}
+
+	tcp_session::buffer_ptr tcp_client_data::make_buf(const char* payload, size_t len)
+	{
+		return frame_raw(payload, len, m_rpc_enabled);
+	}
+
+	tcp_session::buffer_ptr tcp_client_data::make_buf(std::string& json)
+	{
+		return frame_raw(json.data(), json.length(), m_rpc_enabled);
+	}
+
+	tcp_session::buffer_ptr tcp_client_data::make_packed_buf(lua_State* L, int index, std::string& error)
+	{
+		return frame_packed(L, index, m_rpc_enabled, error);
+	}
+
+	tcp_session::buffer_ptr tcp_client_data::make_json_buf(lua_State* L, int index, std::string& error)
+	{
+		return frame_json(L, index, m_rpc_enabled, error);
+	}
+
+	void tcp_client_data::set_heartbeat_payload(const char* payload, size_t len)
+	{
+		m_heartbeat_payload.assign(payload, len);
+	}
+
+	tcp_session::buffer_ptr tcp_client_data::heartbeat_buf()
+	{
+		if (m_heartbeat_payload.compare(0, std::string::npos, default_heartbeat_payload, sizeof(default_heartbeat_payload)) == 0) {
+			return default_heartbeat_buf(m_rpc_enabled);
+		}
+		return make_buf(m_heartbeat_payload.data(), m_heartbeat_payload.size());
+	}
+
+	void tcp_client_data::enable_rpc()
+	{
+		m_rpc_enabled = true;
+
+		// the heartbeat has to carry an id from now on as well.
+		if (m_session) {
+			m_session->heartbeat(heartbeat_buf(), m_session->data().heartbeat_interval());
+		}
+	}
+
+	tcp_session::buffer_ptr tcp_client_data::make_rpc_buf(uint32_t id, const char* payload, size_t len)
+	{
+		tcp_session::buffer_ptr buf(new tcp_session::buffer_type(8 + len));
+
+		buf->putInt(8 + len);
+		buf->putInt(id);
+		buf->putBytes((uint8_t*)payload, len);
+
+		return buf;
+	}
+
+	boost::posix_time::ptime tcp_client_data::on_call_timer()
+	{
+		std::vector<rpc_table::call> expired;
+		m_rpc.expire(boost::asio::deadline_timer::traits_type::now(), expired);
+		if (!expired.empty()) {
+			send_queued_calls();
+		}
+
+		for (size_t i = 0; i < expired.size(); i++) {
+			complete_call(expired[i], NULL, 0, "timeout");
+		}
+		return m_rpc.next_deadline();
+	}
+
+	void tcp_client_data::fail_calls(const char* error)
+	{
+		std::vector<rpc_table::call> calls;
+		m_rpc.take_all(calls);
+
+		for (size_t i = 0; i < calls.size(); i++) {
+			complete_call(calls[i], NULL, 0, error);
+		}
+	}
+
+	void tcp_client_data::attach(tcp_session* session)
+	{
+		m_session = session;
+	}
+
+	void tcp_client_data::send_queued_calls()
+	{
+		if (m_session == nullptr) {
+			return;
+		}
+
+		std::vector<tcp_session::buffer_ptr> frames;
+		m_rpc.take_sendable(frames);
+
+		for (size_t i = 0; i < frames.size(); i++) {
+			m_session->send(frames[i]);
+		}
+	}
+
+	void tcp_client_data::release_call_refs(lua_State* L)
+	{
+		std::vector<int> refs;
+		m_rpc.take_released_refs(refs);
+
+		for (size_t i = 0; i < refs.size(); i++) {
+			luaL_unref(L, LUA_REGISTRYINDEX, refs[i]);
+		}
+	}
+
+	static void push_call_result(lua_State* L, const char* data, size_t len, const char* error)
+	{
+		if (error) {
+			lua_pushnil(L);
+			lua_pushstring(L, error);
+		}
+		else {
+			lua_pushlstring(L, data, len);
+			lua_pushnil(L);
+		}
+	}
+
+	static bool still_running(lua_State* co)
+	{
+		// a coroutine that is on its way to the yield, as opposed to a dead one.
+		lua_Debug ar;
+		return lua_status(co) == LUA_OK && lua_getstack(co, 0, &ar) > 0;
+	}
+
+	void tcp_client_data::send_call(uint32_t id, lua_State* thread, const tcp_session::buffer_ptr& frame)
+	{
+		if (m_session == nullptr || !m_rpc.contains(id)) {
+			return;
+		}
+
+		if (thread == nullptr || !still_running(thread)) {
+			m_session->send(frame);
+			return;
+		}
+
+		// the caller is still between rpc.call and its yield, look again on the io thread.
+		m_session->post(std::bind(&tcp_client_data::send_call, ptr(this), id, thread, frame));
+	}
+
+	void tcp_client_data::complete_call_later(const rpc_table::call& call, const std::string& data, bool failed, const std::string& error)
+	{
+		complete_call(call, data.data(), data.size(), failed ? error.c_str() : NULL);
+	}
+
+	void tcp_client_data::complete_call(const rpc_table::call& call, const char* data, size_t len, const char* error)
+	{
+		lua_State* L = m_lua_state;
+		if (L == nullptr) {
+			return;
+		}
+
+		// answered before the caller got to its yield: keep the response and deliver it
+		// once the coroutine is suspended.
+		if (call.coroutine && call.thread && still_running(call.thread) && m_session) {
+			std::string response = data ? std::string(data, len) : std::string();
+			std::string reason = error ? error : "";
+			if (m_session->post(std::bind(&tcp_client_data::complete_call_later, ptr(this), call, response, error != NULL, reason))) {
+				return;
+			}
+		}
+
+		lua_rawgeti(L, LUA_REGISTRYINDEX, call.ref);
+		m_rpc.release_ref(call.ref);
+
+		if (!call.coroutine) {
+			push_call_result(L, data, len, error);
+			if (lua_pcall(L, 2, 0, 0) != LUA_OK) {
+				lua_pop(L, 1); // error message
+			}
+			return;
+		}
+
+		// stays on L's stack, which keeps it alive while it runs.
+		lua_State* co = lua_tothread(L, -1);
+		if (co == nullptr || lua_status(co) != LUA_YIELD) {
+			lua_pop(L, 1);
+			on_error("rpc call completed, but its coroutine is not suspended");
+			return;
+		}
+
+		push_call_result(co, data, len, error);
+		int status = lua_resume(co, L, 2);
+		if (status == LUA_OK || status == LUA_YIELD) {
+			lua_settop(co, 0); // results, or the values it yielded
+		}
+		else {
+			const char* message = lua_tostring(co, -1);
+			std::string reason = message ? message : "unknown error";
+			lua_pop(co, 1);
+			on_error("rpc coroutine: " + reason);
+		}
+		lua_pop(L, 1);
+	}
+
+	void tcp_client_data::on_frame(const uint8_t* data, uint32_t size)
+	{
+		if (m_rpc_enabled)
+		{
+			if (size < sizeof(uint32_t)) {
+				on_error("invalid rpc frame length");
+				return;
+			}
+
+			uint32_t id = ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | (uint32_t)data[3];
+			data += sizeof(uint32_t);
+			size -= sizeof(uint32_t);
+
+			if (id != 0) {
+				// matched here on the io thread; an unknown id was answered after its timeout.
+				rpc_table::call call;
+				if (m_rpc.take(id, call)) {
+					// refill the window before Lua runs, the wire need not wait for the script.
+					send_queued_calls();
+					complete_call(call, (const char*)data, size, NULL);
+				}
+				return;
+			}
+		}
+
+		if (m_on_packed_ref != LUA_REFNIL && m_lua_state)
+		{
+			call_decoded(m_on_packed_ref, data, size, false);
+		}
+
+		if (m_on_json_ref != LUA_REFNIL && m_lua_state)
+		{
+			call_decoded(m_on_json_ref, data, size, true);
+		}
+
+		if (m_on_packed_ref == LUA_REFNIL && m_on_json_ref == LUA_REFNIL)
+		{
+			std::cout << "response:" << std::string((const char*)data, size) << std::endl;
+		}
+
+		if (m_on_message_ref != LUA_REFNIL)
+		{
+			luautil_call_ref(m_lua_state, m_on_message_ref, (const char*)data, size);
+		}
+	}
+
+	void tcp_client_data::call_decoded(int ref, const uint8_t* data, uint32_t size, bool json)
+	{
+		lua_State* L = m_lua_state;
+		std::string error;
+		frame_call call = { data, size, json, &error };
+
+		// none of these allocate, decoding starts under the pcall.
+		lua_pushcfunction(L, decode_and_call);
+		lua_pushlightuserdata(L, &call);
+		lua_rawgeti(L, LUA_REGISTRYINDEX, ref);
+
+		int status = lua_pcall(L, 2, 0, 0);
+		if (status != LUA_OK) {
+			lua_pop(L, 1); // error message
+		}
+
+		const char* what = json ? "json" : "packed";
+		if (status == LUA_ERRMEM) {
+			on_error(std::string("out of memory handling a ") + what + " message");
+		}
+		else if (!error.empty()) {
+			on_error(std::string("invalid ") + what + " message: " + error);
+		}
+	}
+
 	void tcp_client_data::on_message(tcp_session::buffer_ptr buf)
 	{
 		std::string msg(buf->getRawBuf().begin(), buf->getRawBuf().end());
@@ -96,6 +458,8 @@ namespace net {
 	void tcp_client_data::on_closed()
 	{
 		std::cout << "tcp client closed." << std::endl;
+		fail_calls("connection closed");
+
 		if (m_on_closed_ref != LUA_REFNIL)
 		{
 			luautil_call_ref(m_lua_state, m_on_closed_ref);
@@ -127,6 +491,22 @@ namespace net {
 		m_on_message_ref = ref;
 	}
 
+	void tcp_client_data::set_on_packed_ref(int ref)
+	{
+		if (m_on_packed_ref != LUA_REFNIL) {
+			luautil_unref_function(m_lua_state, m_on_packed_ref);
+		}
+		m_on_packed_ref = ref;
+	}
+
+	void tcp_client_data::set_on_json_ref(int ref)
+	{
+		if (m_on_json_ref != LUA_REFNIL) {
+			luautil_unref_function(m_lua_state, m_on_json_ref);
+		}
+		m_on_json_ref = ref;
+	}
+
 	void tcp_client_data::set_on_closed_ref(int ref)
 	{
 		if (m_on_closed_ref != LUA_REFNIL) {
@@ -4,45 +4,116 @@
 #include "../stream_property.h"
 #include "tcp_session.h"
 #include "tcp_client.h"
+#include "rpc_table.h"
 #include "lua.hpp"
+#include <boost/intrusive_ptr.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
 
 namespace net {
+	// shared by the owning client and the session handlers, which may still run
+	// on the io thread after the client itself has been collected.
 	class tcp_client_data
-		: public boost::enable_shared_from_this<tcp_client_data>
+		: public boost::intrusive_ref_counter<tcp_client_data>
 	{
 	public:
 		typedef tcp_client_data                 data_type;
-		typedef boost::shared_ptr<data_type>    ptr;
+		typedef boost::intrusive_ptr<data_type> ptr;
 
 	public:
-		tcp_session::buffer_ptr make_buf(const char* jsonp, size_t len);
+		// [length:4][payload], or with rpc [length:4][id 0:4][payload], a push.
+		static tcp_session::buffer_ptr frame_raw(const char* payload, size_t len, bool rpc);
+
+		// the value at index of L as MessagePack or JSON, null with error set if it can not be encoded.
+		static tcp_session::buffer_ptr frame_packed(lua_State* L, int index, bool rpc, std::string& error);
+		static tcp_session::buffer_ptr frame_json(lua_State* L, int index, bool rpc, std::string& error);
+
+		// the default heartbeat frame, built once per framing and shared by every session.
+		static const tcp_session::buffer_ptr& default_heartbeat_buf(bool rpc);
+
+		// framed for this client: with a push id once rpc is enabled.
+		tcp_session::buffer_ptr make_buf(const char* payload, size_t len);
 		tcp_session::buffer_ptr make_buf(std::string& json);
+		tcp_session::buffer_ptr make_packed_buf(lua_State* L, int index, std::string& error);
+		tcp_session::buffer_ptr make_json_buf(lua_State* L, int index, std::string& error);
 
-		tcp_session::buffer_ptr make_heartbeat_buf();
+		// payload of the heartbeat, framed as the client currently frames everything.
+		void set_heartbeat_payload(const char* payload, size_t len);
+		tcp_session::buffer_ptr heartbeat_buf();
 
 		void on_connected(const std::string endpoint);
 		void on_message(tcp_session::buffer_ptr buf);
+		void on_frame(const uint8_t* data, uint32_t size);
 		void on_closed();
 		void on_error(const std::string error);
 
+		// rpc framing: [length:4][request id:4][payload] both ways, id 0 for frames that
+		// are not calls or responses, which go to the usual handlers without the id.
+		// Also reframes the heartbeat.
+		void enable_rpc();
+		bool rpc_enabled() const { return m_rpc_enabled; }
+		rpc_table& rpc() { return m_rpc; }
+		static tcp_session::buffer_ptr make_rpc_buf(uint32_t id, const char* payload, size_t len);
+
+		// expire overdue calls, returns the next deadline.
+		boost::posix_time::ptime on_call_timer();
+
+		// send the frame of a call that admit() let through. A coroutine's frame waits
+		// until the coroutine has yielded, so the response can not overtake the yield.
+		void send_call(uint32_t id, lua_State* thread, const tcp_session::buffer_ptr& frame);
+
+		// call back or resume the caller with (response) or (nil, error).
+		void complete_call(const rpc_table::call& call, const char* data, size_t len, const char* error);
+		void fail_calls(const char* error);
+
+		// on the Lua thread: drop the refs of calls completed since the last time.
+		void release_call_refs(lua_State* L);
+
+		// send the queued calls the window has room for.
+		void send_queued_calls();
+
+		// the session whose handlers this object is wired to.
+		void attach(tcp_session* session);
+
 		void set_on_connected_ref(int ref);
 		void set_on_message_ref(int ref);
+		void set_on_packed_ref(int ref);
+		void set_on_json_ref(int ref);
 		void set_on_closed_ref(int ref);
 		void set_on_error_ref(int ref);
 		void set_lua_state(lua_State* L);
 
+		// release the lua references, leaving the object as freshly constructed.
+		void reset();
+
 	public:
 		tcp_client_data();
 		~tcp_client_data();
 
+	private:
+		// decode a frame as MessagePack or JSON and call the handler at ref with it, both
+		// under lua_pcall; errors go to the error handler.
+		void call_decoded(int ref, const uint8_t* data, uint32_t size, bool json);
+
+		// complete_call for a coroutine that has not finished yielding yet, run again on the io thread.
+		void complete_call_later(const rpc_table::call& call, const std::string& data, bool failed, const std::string& error);
+
 	private:
 		int m_on_message_ref;
+		int m_on_packed_ref;
+		int m_on_json_ref;
 		int m_on_connected_ref;
 		int m_on_closed_ref;
 		int m_on_error_ref;
 
 		lua_State* m_lua_state;
 
+		// not owned: the session holds this object through its handlers, never the other way.
+		tcp_session* m_session;
+
+		bool m_rpc_enabled;
+		rpc_table m_rpc;
+
+		std::string m_heartbeat_payload;
 	};
 
 }// namespace ft
@@ -0,0 +1,200 @@
+#include "tcp_client_pool.h"
+#include "tcp_client_data.h"
+#include "tcp_session_data.h"
+#include "../lua_util.h"
+#include <boost/asio/deadline_timer.hpp>
+
+namespace net {
+
+	namespace {
+		typedef void (tcp_client_data::*ref_setter)(int);
+
+		// in tcp_client_pool::handler order.
+		const ref_setter setters[tcp_client_pool::handler_count] = {
+			&tcp_client_data::set_on_message_ref,
+			&tcp_client_data::set_on_packed_ref,
+			&tcp_client_data::set_on_json_ref,
+			&tcp_client_data::set_on_connected_ref,
+			&tcp_client_data::set_on_closed_ref,
+			&tcp_client_data::set_on_error_ref,
+		};
+
+		boost::posix_time::ptime now()
+		{
+			return boost::asio::deadline_timer::traits_type::now();
+		}
+	}
+
+	tcp_client_pool::tcp_client_pool(lua_State* L, const std::string& host, uint32_t port, size_t size)
+		:m_lua_state(L)
+		,m_host(host)
+		,m_port(port)
+		,m_strategy(least_loaded)
+		,m_compress_threshold(0)
+		,m_retry_interval(1)
+		,m_retry_at(size)
+		,m_next(0)
+		,m_open(false)
+		,m_replaced(0)
+	{
+		for (int h = 0; h < handler_count; h++) {
+			m_refs[h] = LUA_REFNIL;
+		}
+
+		m_members.reserve(size);
+		for (size_t i = 0; i < size; i++) {
+			m_members.push_back(create_member());
+		}
+	}
+
+	tcp_client_pool::~tcp_client_pool()
+	{
+		// each client closes its session and drops its refs.
+		for (size_t i = 0; i < m_members.size(); i++) {
+			delete m_members[i];
+		}
+		m_members.clear();
+
+		for (int h = 0; h < handler_count; h++) {
+			if (m_refs[h] != LUA_REFNIL) {
+				luautil_unref_function(m_lua_state, m_refs[h]);
+			}
+		}
+	}
+
+	void tcp_client_pool::set_strategy(strategy s)
+	{
+		m_strategy = s;
+	}
+
+	void tcp_client_pool::set_compression(uint32_t threshold)
+	{
+		m_compress_threshold = threshold;
+		for (size_t i = 0; i < m_members.size(); i++) {
+			m_members[i]->session_data().compress_threshold(threshold);
+		}
+	}
+
+	void tcp_client_pool::set_retry_interval(uint32_t seconds)
+	{
+		m_retry_interval = seconds;
+	}
+
+	void tcp_client_pool::connect()
+	{
+		boost::posix_time::ptime retry_at = now() + boost::posix_time::seconds(m_retry_interval);
+
+		m_open = true;
+		for (size_t i = 0; i < m_members.size(); i++) {
+			if (m_members[i]->session().io_service_stopped()) {
+				m_members[i]->connect();
+				m_retry_at[i] = retry_at;
+			}
+		}
+	}
+
+	void tcp_client_pool::close()
+	{
+		m_open = false;
+		for (size_t i = 0; i < m_members.size(); i++) {
+			if (!m_members[i]->session().io_service_stopped()) {
+				m_members[i]->close();
+			}
+		}
+	}
+
+	void tcp_client_pool::maintain()
+	{
+		if (!m_open) {
+			return;
+		}
+
+		boost::posix_time::ptime t = now();
+		for (size_t i = 0; i < m_members.size(); i++) {
+			if (!m_members[i]->session().io_service_stopped() || t < m_retry_at[i]) {
+				continue;
+			}
+
+			// a new client rather than reconnecting the old session, whose io thread
+			// may still be finishing its close.
+			delete m_members[i];
+			m_members[i] = create_member();
+			m_members[i]->connect();
+			m_retry_at[i] = t + boost::posix_time::seconds(m_retry_interval);
+			m_replaced++;
+		}
+	}
+
+	tcp_client* tcp_client_pool::pick()
+	{
+		maintain();
+
+		size_t n = m_members.size();
+		tcp_client* best = nullptr;
+		size_t best_bytes = 0;
+
+		// start one further each time, so ties do not all land on the first member.
+		size_t start = m_next;
+		m_next = (n == 0) ? 0 : (m_next + 1) % n;
+
+		for (size_t k = 0; k < n; k++) {
+			tcp_client* c = m_members[(start + k) % n];
+			if (!c->session_data().connected()) {
+				continue;
+			}
+			if (m_strategy == round_robin) {
+				return c;
+			}
+
+			size_t bytes = c->session().outbox_bytes();
+			if (best == nullptr || bytes < best_bytes) {
+				best = c;
+				best_bytes = bytes;
+				if (bytes == 0) {
+					break;
+				}
+			}
+		}
+		return best;
+	}
+
+	void tcp_client_pool::set_handler(handler h)
+	{
+		lua_State* L = m_lua_state;
+		if (m_refs[h] != LUA_REFNIL) {
+			luautil_unref_function(L, m_refs[h]);
+		}
+		m_refs[h] = luaL_ref(L, LUA_REGISTRYINDEX);
+
+		for (size_t i = 0; i < m_members.size(); i++) {
+			give_handler(*m_members[i], h);
+		}
+	}
+
+	tcp_client* tcp_client_pool::create_member()
+	{
+		tcp_client* client = new tcp_client();
+
+		client->data().set_lua_state(m_lua_state);
+		client->session_data()
+			.host(m_host)
+			.port(m_port)
+			.compress_threshold(m_compress_threshold);
+
+		for (int h = 0; h < handler_count; h++) {
+			give_handler(*client, (handler)h);
+		}
+		return client;
+	}
+
+	void tcp_client_pool::give_handler(tcp_client& client, handler h)
+	{
+		if (m_refs[h] == LUA_REFNIL) {
+			return;
+		}
+
+		lua_State* L = m_lua_state;
+		lua_rawgeti(L, LUA_REGISTRYINDEX, m_refs[h]);
+		(client.data().*setters[h])(luaL_ref(L, LUA_REGISTRYINDEX));
+	}
+}; // namespace net
@@ -0,0 +1,80 @@
+#ifndef __TCP_CLIENT_POOL_H__
+#define __TCP_CLIENT_POOL_H__
+
+#include "tcp_client.h"
+#include "lua.hpp"
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/noncopyable.hpp>
+#include <string>
+#include <vector>
+
+namespace net {
+
+	// N connections to one upstream. A frame goes to the connected member with the
+	// fewest bytes waiting to be written, or to the next one in turn.
+	// Dead peers are noticed by the sessions themselves (heartbeat write errors, read
+	// timeout); a member whose session closed is replaced by a fresh client once its
+	// retry interval has passed.
+	// Replacing is done by maintain(), which nothing calls on a timer: the io threads
+	// must not create clients and the script's thread has no event loop to post to.
+	// send() runs it first, so a pool that stays busy heals itself; a script that may
+	// go quiet for longer than the retry interval calls pool:maintain() on a schedule
+	// of its own, e.g. next to net.gcStep in its main loop.
+	// Lua thread only: every member holds its own registry refs of the pool's handlers.
+	class tcp_client_pool
+		: private boost::noncopyable
+	{
+	public:
+		enum strategy { least_loaded, round_robin };
+
+		// handlers set on the pool are given to every member.
+		enum handler { on_message, on_packed, on_json, on_connected, on_closed, on_error, handler_count };
+
+	public:
+		tcp_client_pool(lua_State* L, const std::string& host, uint32_t port, size_t size);
+		~tcp_client_pool();
+
+		void set_strategy(strategy s);
+		void set_compression(uint32_t threshold);
+		void set_retry_interval(uint32_t seconds);
+
+		void connect();
+		void close();
+
+		// replace the members that died and are due for a retry.
+		void maintain();
+
+		// the member to send the next frame to, null if none is connected.
+		tcp_client* pick();
+
+		// pops the function on top of L's stack and hands it to every member.
+		void set_handler(handler h);
+
+		size_t size() const { return m_members.size(); }
+		tcp_client& member(size_t i) { return *m_members[i]; }
+		uint32_t replaced() const { return m_replaced; }
+
+	private:
+		tcp_client* create_member();
+		void give_handler(tcp_client& client, handler h);
+
+	private:
+		lua_State* m_lua_state;
+		std::string m_host;
+		uint32_t m_port;
+
+		strategy m_strategy;
+		uint32_t m_compress_threshold;
+		uint32_t m_retry_interval;
+
+		std::vector<tcp_client*> m_members;
+		std::vector<boost::posix_time::ptime> m_retry_at;
+		size_t m_next;
+		bool m_open; // between connect() and close()
+		uint32_t m_replaced;
+
+		int m_refs[handler_count];
+	};
+}; // namespace net
+
+#endif //__TCP_CLIENT_POOL_H__
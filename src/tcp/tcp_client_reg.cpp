@@ -1,47 +1,82 @@
+#include "tcp_client_reg.h"
 #include "tcp_client.h"
 #include "tcp_session_data.h"
 #include "tcp_client_data.h"
 #include "../lua_util.h"
+#include <new>
 
 
 using namespace net;
 
-typedef struct {
-	tcp_client* pT;
-}userdataType;
-
 static const char* packageName = "net.tcp.client";
 
 static int net_tcp_client_new(lua_State* L) {
-	tcp_client *obj = new tcp_client();  // call constructor for T objects 
+	void* block = lua_newuserdata(L, sizeof(tcp_client));
+	tcp_client *obj = new (block) tcp_client();  // construct T inside the userdata block
 
 	obj->data().set_lua_state(L);
 
-	userdataType *ud = static_cast<userdataType*>(lua_newuserdata(L, sizeof(userdataType)));
-	ud->pT = obj;  // store pointer to object in userdata
-
 	luaL_getmetatable(L, packageName);  // lookup metatable in Lua registry  
 	lua_setmetatable(L, -2);
 
 	//std::cout << "tcp client created." << std::endl;
 
-	return 1;  // userdata containing pointer to T object  
+	return 1;  // userdata holding the T object  
 }
 
 static tcp_client* net_tcp_client_check(lua_State *L, int narg) {
-	userdataType *ud = static_cast<userdataType*>(luaL_checkudata(L, narg, packageName));
-	if (!ud) {
-		luaL_argerror(L, narg, packageName);
-		return nullptr;
-	}
-	return ud->pT;  // pointer to T object  
+	return static_cast<tcp_client*>(luaL_checkudata(L, narg, packageName));
+}
+
+net::tcp_client* net_tcp_client_test(lua_State* L, int index) {
+	return static_cast<tcp_client*>(luaL_testudata(L, index, packageName));
+}
+
+void net_tcp_client_push_stats(lua_State* L, tcp_client& client) {
+	lua_createtable(L, 0, 6);
+
+	lua_pushboolean(L, client.session_data().connected());
+	lua_setfield(L, -2, "connected");
+
+	lua_pushinteger(L, (lua_Integer)client.session().outbox_bytes());
+	lua_setfield(L, -2, "outbox_bytes");
+
+	lua_pushinteger(L, (lua_Integer)client.session().handler_calls());
+	lua_setfield(L, -2, "handlers");
+
+	lua_pushinteger(L, client.session_data().cache_capacity());
+	lua_setfield(L, -2, "read_buffer");
+
+	// the options in effect on the current connection.
+	const tcp_session::socket_options& options = client.session_data().applied_socket_options();
+	lua_createtable(L, 0, 5);
+	lua_pushboolean(L, options.nodelay);
+	lua_setfield(L, -2, "nodelay");
+	lua_pushboolean(L, options.quickack);
+	lua_setfield(L, -2, "quickack");
+	lua_pushinteger(L, options.sndbuf);
+	lua_setfield(L, -2, "sndbuf");
+	lua_pushinteger(L, options.rcvbuf);
+	lua_setfield(L, -2, "rcvbuf");
+	lua_pushinteger(L, options.busy_poll);
+	lua_setfield(L, -2, "busy_poll");
+	lua_setfield(L, -2, "socket");
+
+	const tcp_session::io_options& io = client.session_data().io_options();
+	lua_createtable(L, 0, 3);
+	lua_pushinteger(L, io.spin_us);
+	lua_setfield(L, -2, "spin");
+	lua_pushinteger(L, client.session_data().io_cpu());
+	lua_setfield(L, -2, "cpu");
+	lua_pushinteger(L, (lua_Integer)client.session().io_sleeps());
+	lua_setfield(L, -2, "sleeps");
+	lua_setfield(L, -2, "io");
 }
 
 static int net_tcp_client_gc(lua_State* L) {
-	userdataType *ud = static_cast<userdataType*>(lua_touserdata(L, 1));
-	tcp_client *obj = ud->pT;
+	tcp_client *obj = static_cast<tcp_client*>(lua_touserdata(L, 1));
 	if (obj) {
-		delete obj;  // call destructor for T objects  
+		obj->~tcp_client();  // Lua frees the block itself
 	}
 	return 0;
 }
@@ -72,6 +107,119 @@ static int net_tcp_client_setPort(lua_State* L) {
 	return 0;
 }
 
+static int net_tcp_client_setCompression(lua_State* L) {
+	tcp_client* s = net_tcp_client_check(L, 1);
+
+	// payloads of at least threshold bytes go out compressed, 0 turns it off.
+	lua_Integer threshold = luaL_optinteger(L, 2, 512);
+	luaL_argcheck(L, threshold >= 0, 2, "threshold must not be negative");
+
+	s->session_data()
+		.compress_threshold((uint32_t)threshold);
+
+	return 0;
+}
+
+// tcp:setHeartbeat(payload[, interval]) sends payload after interval seconds (default 3)
+// without writes; a nil payload keeps the current one, interval 0 turns heartbeats off.
+static int net_tcp_client_setHeartbeat(lua_State* L) {
+	tcp_client* s = net_tcp_client_check(L, 1);
+
+	tcp_session::buffer_ptr frame;
+	if (!lua_isnoneornil(L, 2)) {
+		size_t len = 0;
+		const char* payload = luaL_checklstring(L, 2, &len);
+		s->data().set_heartbeat_payload(payload, len);
+		frame = s->data().heartbeat_buf();
+	}
+
+	lua_Integer interval = luaL_optinteger(L, 3, 3);
+	luaL_argcheck(L, interval >= 0, 3, "interval must not be negative");
+
+	s->session().heartbeat(frame, (uint32_t)interval);
+
+	return 0;
+}
+
+static int net_tcp_client_opt_int(lua_State* L, const char* field)
+{
+	lua_getfield(L, 2, field);
+	lua_Integer value = lua_isnil(L, -1) ? 0 : luaL_checkinteger(L, -1);
+	lua_pop(L, 1);
+	luaL_argcheck(L, value >= 0 && value <= 0x7fffffff, 2, field);
+	return (int)value;
+}
+
+// tcp:setSocketOptions{nodelay=, quickack=, sndbuf=, rcvbuf=, busy_poll=} takes effect
+// on the next connect; missing fields keep the system default.
+static int net_tcp_client_setSocketOptions(lua_State* L) {
+	tcp_client* s = net_tcp_client_check(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	tcp_session::socket_options options;
+
+	lua_getfield(L, 2, "nodelay");
+	options.nodelay = lua_toboolean(L, -1) != 0;
+	lua_getfield(L, 2, "quickack");
+	options.quickack = lua_toboolean(L, -1) != 0;
+	lua_pop(L, 2);
+
+	options.sndbuf = net_tcp_client_opt_int(L, "sndbuf");
+	options.rcvbuf = net_tcp_client_opt_int(L, "rcvbuf");
+	options.busy_poll = net_tcp_client_opt_int(L, "busy_poll");
+
+	s->session_data()
+		.socket_options(options);
+
+	return 0;
+}
+
+// tcp:setReadOptions{max_buffer=, drain=}: the read buffer grows up to max_buffer bytes
+// while reads come back full (default 8 times the frame limit, anything below it keeps
+// the buffer fixed); drain reads until EAGAIN before waiting again, from the next connect.
+static int net_tcp_client_setReadOptions(lua_State* L) {
+	tcp_client* s = net_tcp_client_check(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	lua_getfield(L, 2, "max_buffer");
+	if (!lua_isnil(L, -1)) {
+		lua_Integer limit = luaL_checkinteger(L, -1);
+		luaL_argcheck(L, limit >= 0 && limit <= 0x40000000, 2, "max_buffer out of range");
+		s->session_data().read_buffer_limit((uint32_t)limit);
+	}
+	lua_pop(L, 1);
+
+	lua_getfield(L, 2, "drain");
+	if (!lua_isnil(L, -1)) {
+		s->session_data().read_drain(lua_toboolean(L, -1) != 0);
+	}
+	lua_pop(L, 1);
+
+	return 0;
+}
+
+// tcp:setIoOptions{spin=, cpu=} from the next connect: the io thread polls for spin
+// microseconds before blocking (0, the default, blocks at once) and is pinned to cpu
+// (nil or -1 takes the next of net.setIoCpus, if set). Spinning costs a core per session.
+static int net_tcp_client_setIoOptions(lua_State* L) {
+	tcp_client* s = net_tcp_client_check(L, 1);
+	luaL_checktype(L, 2, LUA_TTABLE);
+
+	tcp_session::io_options options;
+	options.spin_us = (uint32_t)net_tcp_client_opt_int(L, "spin");
+
+	lua_getfield(L, 2, "cpu");
+	lua_Integer cpu = luaL_optinteger(L, -1, -1);
+	lua_pop(L, 1);
+	luaL_argcheck(L, cpu >= -1 && cpu <= 0xffff, 2, "cpu out of range");
+	options.cpu = (int)cpu;
+
+	s->session_data()
+		.io_options(options);
+
+	return 0;
+}
+
 static int net_tcp_client_connect(lua_State* L) {
 	tcp_client* s = net_tcp_client_check(L, 1);
 	if (s) {
@@ -97,6 +245,36 @@ static int net_tcp_client_send(lua_State* L)
 	return 0;
 }
 
+static int net_tcp_client_sendPacked(lua_State* L)
+{
+	tcp_client* s = net_tcp_client_check(L, 1);
+	luaL_checkany(L, 2);
+
+	std::string error;
+	tcp_session::buffer_ptr buf = s->data().make_packed_buf(L, 2, error);
+	if (!buf) {
+		return luaL_error(L, "sendPacked: %s", error.c_str());
+	}
+
+	s->send(buf);
+	return 0;
+}
+
+static int net_tcp_client_sendJson(lua_State* L)
+{
+	tcp_client* s = net_tcp_client_check(L, 1);
+	luaL_checkany(L, 2);
+
+	std::string error;
+	tcp_session::buffer_ptr buf = s->data().make_json_buf(L, 2, error);
+	if (!buf) {
+		return luaL_error(L, "sendJson: %s", error.c_str());
+	}
+
+	s->send(buf);
+	return 0;
+}
+
 static int net_tcp_client_close(lua_State* L)
 {
 	tcp_client* s = net_tcp_client_check(L, 1);
@@ -108,6 +286,13 @@ static int net_tcp_client_close(lua_State* L)
 	return 0;
 }
 
+static int net_tcp_client_stats(lua_State* L)
+{
+	tcp_client* s = net_tcp_client_check(L, 1);
+	net_tcp_client_push_stats(L, *s);
+	return 1;
+}
+
 static int net_tcp_client_onMessage(lua_State* L)
 {
 	tcp_client* s = net_tcp_client_check(L, 1);
@@ -120,6 +305,28 @@ static int net_tcp_client_onMessage(lua_State* L)
 	return 0;
 }
 
+static int net_tcp_client_onPacked(lua_State* L)
+{
+	tcp_client* s = net_tcp_client_check(L, 1);
+
+	if (s && lua_isfunction(L, -1)) {
+		int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+		s->data().set_on_packed_ref(ref);
+	}
+	return 0;
+}
+
+static int net_tcp_client_onJson(lua_State* L)
+{
+	tcp_client* s = net_tcp_client_check(L, 1);
+
+	if (s && lua_isfunction(L, -1)) {
+		int ref = luaL_ref(L, LUA_REGISTRYINDEX);
+		s->data().set_on_json_ref(ref);
+	}
+	return 0;
+}
+
 static int net_tcp_client_onConnected(lua_State* L)
 {
 	tcp_client* s = net_tcp_client_check(L, 1);
@@ -165,10 +372,20 @@ static const luaL_Reg tcp_client_lib_m[] = {
 static const luaL_Reg tcp_client_lib_f[] = {
 	{ "setHost", net_tcp_client_setHost },
 	{ "setPort", net_tcp_client_setPort },
+	{ "setCompression", net_tcp_client_setCompression },
+	{ "setHeartbeat", net_tcp_client_setHeartbeat },
+	{ "setSocketOptions", net_tcp_client_setSocketOptions },
+	{ "setReadOptions", net_tcp_client_setReadOptions },
+	{ "setIoOptions", net_tcp_client_setIoOptions },
 	{ "connect", net_tcp_client_connect },
 	{ "send", net_tcp_client_send },
+	{ "sendPacked", net_tcp_client_sendPacked },
+	{ "sendJson", net_tcp_client_sendJson },
 	{ "close", net_tcp_client_close },
+	{ "stats", net_tcp_client_stats },
 	{ "onMessage", net_tcp_client_onMessage },
+	{ "onPacked", net_tcp_client_onPacked },
+	{ "onJson", net_tcp_client_onJson },
 	{ "onConnected", net_tcp_client_onConnected },
 	{ "onClosed", net_tcp_client_onClosed },
 	{ "onError", net_tcp_client_onError },
@@ -3,7 +3,17 @@
 
 #include "lua.hpp"
 
+namespace net {
+	class tcp_client;
+}
+
 extern int register_net_tcp_client(lua_State* L);
 
+// the tcp client at index, or NULL if it is something else.
+extern net::tcp_client* net_tcp_client_test(lua_State* L, int index);
+
+// push a table describing the client's connection.
+extern void net_tcp_client_push_stats(lua_State* L, net::tcp_client& client);
+
 
 #endif // ! __TCP_CLIENT_REG_H__
\ No newline at end of file
@@ -0,0 +1,277 @@
+#include "tcp_pool_reg.h"
+#include "tcp_client_pool.h"
+#include "tcp_client_reg.h"
+#include "tcp_client.h"
+#include "tcp_client_data.h"
+#include "tcp_session_data.h"
+#include <cstring>
+#include <new>
+
+using namespace net;
+
+static const char* packageName = "net.tcp.pool";
+
+static lua_Integer net_tcp_pool_opt_integer(lua_State* L, const char* field, lua_Integer def)
+{
+	lua_getfield(L, 1, field);
+	lua_Integer value = lua_isnil(L, -1) ? def : luaL_checkinteger(L, -1);
+	lua_pop(L, 1);
+	return value;
+}
+
+// pool.new{host=, port=, size=4, strategy="least"|"round", compression=0, retry=1}
+static int net_tcp_pool_new(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+
+	lua_getfield(L, 1, "host");
+	std::string host = luaL_checkstring(L, -1);
+	lua_pop(L, 1);
+
+	lua_Integer port = net_tcp_pool_opt_integer(L, "port", 0);
+	lua_Integer size = net_tcp_pool_opt_integer(L, "size", 4);
+	lua_Integer compression = net_tcp_pool_opt_integer(L, "compression", 0);
+	lua_Integer retry = net_tcp_pool_opt_integer(L, "retry", 1);
+	luaL_argcheck(L, port > 0 && port <= 65535, 1, "port out of range");
+	luaL_argcheck(L, size > 0 && size <= 1024, 1, "size out of range");
+	luaL_argcheck(L, compression >= 0, 1, "compression must not be negative");
+	luaL_argcheck(L, retry >= 0, 1, "retry must not be negative");
+
+	tcp_client_pool::strategy strategy = tcp_client_pool::least_loaded;
+	lua_getfield(L, 1, "strategy");
+	if (!lua_isnil(L, -1)) {
+		const char* name = luaL_checkstring(L, -1);
+		if (strcmp(name, "round") == 0) {
+			strategy = tcp_client_pool::round_robin;
+		}
+		else if (strcmp(name, "least") != 0) {
+			return luaL_argerror(L, 1, "strategy must be \"least\" or \"round\"");
+		}
+	}
+	lua_pop(L, 1);
+
+	void* block = lua_newuserdata(L, sizeof(tcp_client_pool));
+	tcp_client_pool* obj = new (block) tcp_client_pool(L, host, (uint32_t)port, (size_t)size);
+
+	obj->set_strategy(strategy);
+	obj->set_compression((uint32_t)compression);
+	obj->set_retry_interval((uint32_t)retry);
+
+	luaL_getmetatable(L, packageName);
+	lua_setmetatable(L, -2);
+
+	return 1;
+}
+
+static tcp_client_pool* net_tcp_pool_check(lua_State* L, int narg) {
+	return static_cast<tcp_client_pool*>(luaL_checkudata(L, narg, packageName));
+}
+
+static int net_tcp_pool_gc(lua_State* L) {
+	tcp_client_pool* obj = static_cast<tcp_client_pool*>(lua_touserdata(L, 1));
+	if (obj) {
+		obj->~tcp_client_pool();
+	}
+	return 0;
+}
+
+static int net_tcp_pool_connect(lua_State* L)
+{
+	net_tcp_pool_check(L, 1)->connect();
+	return 0;
+}
+
+static int net_tcp_pool_close(lua_State* L)
+{
+	net_tcp_pool_check(L, 1)->close();
+	return 0;
+}
+
+// pool:maintain() replaces the members that died and are due for a retry. pool:send does
+// it too; call it every retry interval or so while the pool may sit idle.
+static int net_tcp_pool_maintain(lua_State* L)
+{
+	net_tcp_pool_check(L, 1)->maintain();
+	return 0;
+}
+
+static int net_tcp_pool_size(lua_State* L)
+{
+	lua_pushinteger(L, (lua_Integer)net_tcp_pool_check(L, 1)->size());
+	return 1;
+}
+
+// pool:send(payload), false if no member is connected.
+static int net_tcp_pool_send(lua_State* L)
+{
+	tcp_client_pool* pool = net_tcp_pool_check(L, 1);
+	size_t len = 0;
+	const char* payload = luaL_checklstring(L, 2, &len);
+
+	tcp_client* client = pool->pick();
+	if (client) {
+		client->send(payload, len);
+	}
+	lua_pushboolean(L, client != nullptr);
+	return 1;
+}
+
+static int net_tcp_pool_send_encoded(lua_State* L, bool json)
+{
+	tcp_client_pool* pool = net_tcp_pool_check(L, 1);
+	luaL_checkany(L, 2);
+
+	tcp_client* client = pool->pick();
+	if (!client) {
+		lua_pushboolean(L, 0);
+		return 1;
+	}
+
+	std::string error;
+	tcp_session::buffer_ptr buf = json
+		? client->data().make_json_buf(L, 2, error)
+		: client->data().make_packed_buf(L, 2, error);
+	if (!buf) {
+		return luaL_error(L, "%s: %s", json ? "sendJson" : "sendPacked", error.c_str());
+	}
+
+	client->send(buf);
+	lua_pushboolean(L, 1);
+	return 1;
+}
+
+static int net_tcp_pool_sendPacked(lua_State* L)
+{
+	return net_tcp_pool_send_encoded(L, false);
+}
+
+static int net_tcp_pool_sendJson(lua_State* L)
+{
+	return net_tcp_pool_send_encoded(L, true);
+}
+
+// pool:stats() returns { replaced = n, [i] = member i's tcp:stats() }.
+static int net_tcp_pool_stats(lua_State* L)
+{
+	tcp_client_pool* pool = net_tcp_pool_check(L, 1);
+
+	lua_createtable(L, (int)pool->size(), 1);
+	for (size_t i = 0; i < pool->size(); i++) {
+		net_tcp_client_push_stats(L, pool->member(i));
+		lua_rawseti(L, -2, (lua_Integer)(i + 1));
+	}
+
+	lua_pushinteger(L, pool->replaced());
+	lua_setfield(L, -2, "replaced");
+
+	return 1;
+}
+
+static int net_tcp_pool_set_handler(lua_State* L, tcp_client_pool::handler h)
+{
+	tcp_client_pool* pool = net_tcp_pool_check(L, 1);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+
+	lua_settop(L, 2);
+	pool->set_handler(h);
+	return 0;
+}
+
+static int net_tcp_pool_onMessage(lua_State* L)
+{
+	return net_tcp_pool_set_handler(L, tcp_client_pool::on_message);
+}
+
+static int net_tcp_pool_onPacked(lua_State* L)
+{
+	return net_tcp_pool_set_handler(L, tcp_client_pool::on_packed);
+}
+
+static int net_tcp_pool_onJson(lua_State* L)
+{
+	return net_tcp_pool_set_handler(L, tcp_client_pool::on_json);
+}
+
+static int net_tcp_pool_onConnected(lua_State* L)
+{
+	return net_tcp_pool_set_handler(L, tcp_client_pool::on_connected);
+}
+
+static int net_tcp_pool_onClosed(lua_State* L)
+{
+	return net_tcp_pool_set_handler(L, tcp_client_pool::on_closed);
+}
+
+static int net_tcp_pool_onError(lua_State* L)
+{
+	return net_tcp_pool_set_handler(L, tcp_client_pool::on_error);
+}
+
+static const luaL_Reg tcp_pool_lib_m[] = {
+	{ "new", net_tcp_pool_new },
+	{ "__gc", net_tcp_pool_gc },
+	{ NULL, NULL },
+};
+
+static const luaL_Reg tcp_pool_lib_f[] = {
+	{ "connect", net_tcp_pool_connect },
+	{ "close", net_tcp_pool_close },
+	{ "maintain", net_tcp_pool_maintain },
+	{ "size", net_tcp_pool_size },
+	{ "send", net_tcp_pool_send },
+	{ "sendPacked", net_tcp_pool_sendPacked },
+	{ "sendJson", net_tcp_pool_sendJson },
+	{ "stats", net_tcp_pool_stats },
+	{ "onMessage", net_tcp_pool_onMessage },
+	{ "onPacked", net_tcp_pool_onPacked },
+	{ "onJson", net_tcp_pool_onJson },
+	{ "onConnected", net_tcp_pool_onConnected },
+	{ "onClosed", net_tcp_pool_onClosed },
+	{ "onError", net_tcp_pool_onError },
+	{ NULL, NULL },
+};
+
+int luaopen_net_tcp_pool(lua_State* L)
+{
+	//create metatable
+	luaL_newmetatable(L, packageName);
+	int metatable = lua_gettop(L);
+
+	for (const luaL_Reg *l = tcp_pool_lib_m; l->name; l++) {
+		lua_pushstring(L, l->name);
+		lua_pushcfunction(L, l->func);
+		lua_settable(L, metatable);
+	}
+
+	lua_pushstring(L, "__NAME");
+	lua_pushstring(L, packageName);
+	lua_settable(L, metatable);
+
+	//metatable.__index = methodtable
+	lua_pushliteral(L, "__index");
+
+	lua_newtable(L);
+	int methods = lua_gettop(L);
+
+	for (const luaL_Reg *l = tcp_pool_lib_f; l->name; l++) {
+		lua_pushstring(L, l->name);
+		lua_pushcfunction(L, l->func);
+		lua_settable(L, methods);
+	}
+	lua_settable(L, metatable);
+
+	return 1;
+}
+
+int register_net_tcp_pool(lua_State* L)
+{
+	lua_getglobal(L, "package");
+	lua_getfield(L, -1, "preload");
+
+	lua_pushcfunction(L, luaopen_net_tcp_pool);
+	lua_setfield(L, -2, packageName);
+
+	lua_pop(L, 2);
+
+	return 0;
+}
@@ -0,0 +1,8 @@
+#ifndef __TCP_POOL_REG_H__
+#define __TCP_POOL_REG_H__
+
+#include "lua.hpp"
+
+extern int register_net_tcp_pool(lua_State* L);
+
+#endif // !__TCP_POOL_REG_H__
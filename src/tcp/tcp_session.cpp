@@ -1,5 +1,7 @@
 #include "tcp_session.h"
 #include "tcp_session_data.h"
+#include "../codec/lz4_block.h"
+#include "../thread_affinity.h"
 #include <boost/lexical_cast.hpp> 
 #include <boost/bind.hpp>
 #include <boost/thread.hpp>
@@ -9,8 +11,38 @@ using boost::asio::io_service;
 using boost::asio::ip::tcp;
 
 namespace net {
+
+	namespace {
+		// period of the session tick, which is also the resolution of heartbeat_interval.
+		const long tick_seconds = 1;
+
+		// non-blocking reads in a row before the reactor gets its turn again.
+		const int max_drain_reads = 16;
+
+		// reads this far below the buffer size in a row halve a grown read buffer.
+		const uint32_t shrink_after_sparse_reads = 64;
+
+		// buffers gathered into one write, well below IOV_MAX.
+		const size_t max_write_buffers = 64;
+
+#if defined(TCP_QUICKACK)
+		typedef boost::asio::detail::socket_option::boolean<IPPROTO_TCP, TCP_QUICKACK> quick_ack;
+#endif
+#if defined(SO_BUSY_POLL)
+		typedef boost::asio::detail::socket_option::integer<SOL_SOCKET, SO_BUSY_POLL> busy_poll;
+#endif
+
+		// the session whose run() the current thread is in.
+		thread_local const tcp_session* current_io_session = NULL;
+	}
+
 	tcp_session::tcp_session()
 		:m_data(new tcp_session_data())
+		,m_write_frames(0)
+		,m_outbox_bytes(0)
+		,m_handler_calls(0)
+		,m_io_sleeps(0)
+		,m_io_threads(0)
 	{
 		
 	}
@@ -27,12 +59,17 @@ namespace net {
 		//std::cout << "host:" << m_data->host() << ", port:" << m_data->port() << std::endl;
 
 		memset(m_data->cache_buffer(), 0, 8 * sizeof(uint32_t)); // reset first 64 bit with 0
+		m_data->cache_write_position(0);
+		m_data->cache_read_position(0);
 
 		m_data->io_service().reset(new boost::asio::io_service());
 		m_data->socket().reset(new boost::asio::ip::tcp::socket(*m_data->io_service()));
 		m_data->strand().reset(new boost::asio::io_service::strand(*m_data->io_service()));
 		m_data->deadline().reset(new boost::asio::deadline_timer(*m_data->io_service()));
-		m_data->heartbeat_timer().reset(new boost::asio::deadline_timer(*m_data->io_service()));
+		m_data->tick_timer().reset(new boost::asio::deadline_timer(*m_data->io_service()));
+		m_data->call_timer().reset(new boost::asio::deadline_timer(*m_data->io_service()));
+		m_data->call_timer_armed(false);
+		m_outbox_bytes = 0;
 
 		boost::asio::ip::tcp::resolver resolver(*m_data->io_service());
 		tcp::resolver::query query(m_data->host(), boost::lexical_cast<std::string, uint16_t>(m_data->port()));
@@ -46,21 +83,56 @@ namespace net {
 		// Start the deadline actor. You will note that we're not setting any
 		// particular deadline here. Instead, the connect and input actors will
 		// update the deadline prior to each asynchronous operation.
-		m_data->deadline()->async_wait(boost::bind(&tcp_session::check_deadline, shared_from_this(), boost::asio::placeholders::error));
+		m_data->deadline()->async_wait(make_custom_alloc_handler(m_deadline_memory,
+			boost::bind(&tcp_session::check_deadline, this, boost::asio::placeholders::error)));
+
+		// Lua callbacks run on the io thread too, so its cpu is where all of the
+		// session's work happens.
+		io_options options = m_data->io_options();
+		if (options.cpu < 0) {
+			options.cpu = affinity::next_io_cpu();
+		}
+		m_data->io_cpu(options.cpu);
 
-		boost::thread t(boost::bind(&boost::asio::io_service::run, m_data->io_service()));
+		{
+			boost::mutex::scoped_lock lock(m_io_threads_mutex);
+			m_io_threads++;
+		}
+		boost::thread t(boost::bind(&tcp_session::run, ptr(this), m_data->io_service(), options));
 		t.detach();
 
 		return *this;
 	}
 
-	tcp_session& tcp_session::send(boost::shared_ptr<buffer_type> snd_buf)
+	tcp_session& tcp_session::send(const buffer_ptr& snd_buf)
+	{
+		if (m_data->compress_threshold() != 0) {
+			// on the caller's thread, the io thread only ever writes.
+			return enqueue(compress_frame(snd_buf));
+		}
+		return enqueue(snd_buf);
+	}
+
+	tcp_session& tcp_session::enqueue(const buffer_ptr& frame)
+	{
+		if (io_service_stopped()){
+			caught_error("connection already closed.");
+			return *this;
+		}
+		m_outbox_bytes += frame->getRawBuf().size();
+		m_data->strand()->post(boost::bind(&tcp_session::start_write, this, frame));
+
+		return *this;
+	}
+
+	tcp_session& tcp_session::send(const slab_ptr& frame)
 	{
 		if (io_service_stopped()){
 			caught_error("connection already closed.");
 			return *this;
 		}
-		m_data->strand()->post(boost::bind(&tcp_session::start_write, shared_from_this(), snd_buf));
+		m_outbox_bytes += frame->size();
+		m_data->strand()->post(boost::bind(&tcp_session::start_write_slabs, this, frame));
 
 		return *this;
 	}
@@ -72,20 +144,125 @@ namespace net {
 			return *this;
 		}
 
-		m_data->strand()->post(boost::bind(&tcp_session::start_close, shared_from_this()));
+		m_data->strand()->post(boost::bind(&tcp_session::start_close, this));
 		return *this;
 	}
 
+	void tcp_session::wait_io_threads()
+	{
+		if (current_io_session == this) {
+			return;
+		}
+
+		boost::mutex::scoped_lock lock(m_io_threads_mutex);
+		while (m_io_threads != 0) {
+			m_io_threads_done.wait(lock);
+		}
+	}
+
 	bool tcp_session::io_service_stopped()
 	{
 		return m_data->io_service() == nullptr || m_data->io_service()->stopped();
 	}
 
+	size_t tcp_session::outbox_bytes() const
+	{
+		return m_outbox_bytes;
+	}
+
+	uint64_t tcp_session::handler_calls() const
+	{
+		return m_handler_calls.load(std::memory_order_relaxed);
+	}
+
+	uint64_t tcp_session::io_sleeps() const
+	{
+		return m_io_sleeps.load(std::memory_order_relaxed);
+	}
+
+	tcp_session& tcp_session::heartbeat(const buffer_ptr& frame, uint32_t interval)
+	{
+		if (io_service_stopped()){
+			set_heartbeat(frame, interval);
+			return *this;
+		}
+		m_data->strand()->post(boost::bind(&tcp_session::set_heartbeat, this, frame, interval));
+
+		return *this;
+	}
+
+	bool tcp_session::post(const std::function<void()>& handler)
+	{
+		if (io_service_stopped()){
+			return false;
+		}
+		m_data->strand()->post(handler);
+
+		return true;
+	}
+
+	tcp_session& tcp_session::schedule_call_timer(boost::posix_time::ptime at)
+	{
+		if (io_service_stopped()){
+			return *this;
+		}
+		m_data->strand()->post(boost::bind(&tcp_session::start_call_timer, this, at));
+
+		return *this;
+	}
+
 	tcp_session_data& tcp_session::data(){
 		return *m_data;
 	}
 
 	// protected
+	void tcp_session::run(ptr session, boost::shared_ptr<boost::asio::io_service> io_service, io_options options)
+	{
+		current_io_session = session.get();
+		struct exit_scope {
+			tcp_session* session;
+			~exit_scope() { session->io_thread_exited(); }
+		} scope = { session.get() };
+
+		if (options.cpu >= 0 && !affinity::pin_current_thread(options.cpu)) {
+			session->caught_error("cannot pin io thread to cpu " + boost::lexical_cast<std::string>(options.cpu));
+		}
+
+		// session stays alive until run() returns, which is after the last handler has run.
+		if (options.spin_us == 0) {
+			io_service->run();
+			return;
+		}
+
+		// poll() and run_one() stop the io_service once it runs out of work, like run().
+		boost::posix_time::time_duration budget = boost::posix_time::microseconds(options.spin_us);
+		while (!io_service->stopped()) {
+			if (io_service->poll() > 0) {
+				continue;
+			}
+
+			boost::posix_time::ptime until = boost::asio::deadline_timer::traits_type::now() + budget;
+			size_t ran = 0;
+			while (ran == 0 && !io_service->stopped() && boost::asio::deadline_timer::traits_type::now() < until) {
+				ran = io_service->poll_one();
+			}
+
+			if (ran == 0 && !io_service->stopped()) {
+				session->m_io_sleeps.fetch_add(1, std::memory_order_relaxed);
+				io_service->run_one();
+			}
+		}
+	}
+
+	void tcp_session::io_thread_exited()
+	{
+		current_io_session = NULL;
+
+		boost::mutex::scoped_lock lock(m_io_threads_mutex);
+		m_io_threads--;
+		m_io_threads_done.notify_all();
+	}
+
 	void tcp_session::start_connect(boost::asio::ip::tcp::resolver::iterator endpoint_iter)
 	{
 		if (endpoint_iter != tcp::resolver::iterator())
@@ -95,9 +272,30 @@ namespace net {
 			// Set a deadline for the connect operation.
 			m_data->deadline()->expires_from_now(boost::posix_time::seconds(m_data->connect_timeout()));
 
+			// Open it ourselves so the options are in place before the SYN; the buffer
+			// sizes decide the window scale the connection is set up with.
+			if (!m_data->socket()->is_open())
+			{
+				boost::system::error_code ec;
+				m_data->socket()->open(endpoint_iter->endpoint().protocol(), ec);
+				if (ec)
+				{
+					caught_error(ec.message());
+					start_connect(++endpoint_iter);
+					return;
+				}
+				apply_socket_options();
+
+				// asio's async operations cope with a non-blocking socket, drain() needs one.
+				m_data->socket()->non_blocking(m_data->read_drain(), ec);
+				if (ec) {
+					caught_error("drain: " + ec.message());
+				}
+			}
+
 			// Start the asynchronous connect operation.
 			m_data->socket()->async_connect(endpoint_iter->endpoint(),
-				boost::bind(&tcp_session::handle_connect, shared_from_this(), boost::asio::placeholders::error, endpoint_iter));
+				boost::bind(&tcp_session::handle_connect, this, boost::asio::placeholders::error, endpoint_iter));
 		}
 		else
 		{
@@ -106,8 +304,81 @@ namespace net {
 		}
 	}
 
+	void tcp_session::apply_socket_options()
+	{
+		const socket_options& want = m_data->socket_options();
+		socket_options& got = m_data->applied_socket_options();
+		tcp::socket& socket = *m_data->socket();
+		boost::system::error_code ec;
+
+		// a refused option is reported, the connection goes ahead without it.
+		if (want.nodelay) {
+			socket.set_option(tcp::no_delay(true), ec);
+			if (ec) {
+				caught_error("nodelay: " + ec.message());
+			}
+		}
+		if (want.sndbuf > 0) {
+			socket.set_option(boost::asio::socket_base::send_buffer_size(want.sndbuf), ec);
+			if (ec) {
+				caught_error("sndbuf: " + ec.message());
+			}
+		}
+		if (want.rcvbuf > 0) {
+			socket.set_option(boost::asio::socket_base::receive_buffer_size(want.rcvbuf), ec);
+			if (ec) {
+				caught_error("rcvbuf: " + ec.message());
+			}
+		}
+		if (want.busy_poll > 0) {
+#if defined(SO_BUSY_POLL)
+			socket.set_option(busy_poll(want.busy_poll), ec);
+			if (ec) {
+				caught_error("busy_poll: " + ec.message());
+			}
+#else
+			caught_error("busy_poll: not supported on this platform");
+#endif
+		}
+		if (want.quickack) {
+#if defined(TCP_QUICKACK)
+			socket.set_option(quick_ack(true), ec);
+			if (ec) {
+				caught_error("quickack: " + ec.message());
+			}
+#else
+			caught_error("quickack: not supported on this platform");
+#endif
+		}
+
+		// what the kernel settled on. Linux doubles buffer sizes, asio halves them back,
+		// so they compare with what was asked for.
+		tcp::no_delay nodelay;
+		socket.get_option(nodelay, ec);
+		got.nodelay = !ec && nodelay.value();
+
+		boost::asio::socket_base::send_buffer_size sndbuf;
+		socket.get_option(sndbuf, ec);
+		got.sndbuf = ec ? 0 : sndbuf.value();
+
+		boost::asio::socket_base::receive_buffer_size rcvbuf;
+		socket.get_option(rcvbuf, ec);
+		got.rcvbuf = ec ? 0 : rcvbuf.value();
+
+#if defined(SO_BUSY_POLL)
+		busy_poll poll;
+		socket.get_option(poll, ec);
+		got.busy_poll = ec ? 0 : poll.value();
+#endif
+#if defined(TCP_QUICKACK)
+		got.quickack = want.quickack;
+#endif
+	}
+
 	void tcp_session::handle_connect(const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::iterator endpoint_iter)
 	{
+		m_handler_calls.fetch_add(1, std::memory_order_relaxed);
+
 		if (!m_data->connecting() || ec == boost::asio::error::operation_aborted)
 		{
 			this->caught_error("operation_aborted:" + ec.message());
@@ -149,9 +420,16 @@ namespace net {
 			// Start the input actor.
 			start_read();
 
-			// Wait before sending the next heartbeat or customer message.
-			m_data->heartbeat_timer()->expires_from_now(boost::posix_time::seconds(m_data->heartbeat_interval()));
-			m_data->heartbeat_timer()->async_wait(boost::bind(&tcp_session::send_heartbeat, shared_from_this(), boost::asio::placeholders::error));
+			// The deadline only guarded the connect. From now on the tick watches for
+			// reads, so reading touches no timer.
+			m_data->deadline()->expires_at(boost::posix_time::pos_infin);
+
+			// Start the tick, which sends heartbeats once writes go quiet.
+			m_data->ticks(0);
+			m_data->last_write_tick(0);
+			m_data->last_read_tick(0);
+			m_data->tick_timer()->expires_from_now(boost::posix_time::seconds(tick_seconds));
+			start_tick();
 
 			on_connected(endpoint_iter->endpoint());
 		}
@@ -169,64 +447,42 @@ namespace net {
 
 	void tcp_session::start_read()
 	{
-		// Set a deadline for the read operation.
-		m_data->deadline()->expires_from_now(boost::posix_time::seconds(m_data->read_timeout()));
-
 		// Waiting to read.
 		m_data->socket()->async_read_some(
 			boost::asio::buffer(
 				(m_data->cache_buffer() + m_data->cache_write_position()),
-				(m_data->cache_size() - m_data->cache_write_position())),
-			boost::bind(&tcp_session::handle_read, shared_from_this(), 
-				boost::asio::placeholders::error, 
-				boost::asio::placeholders::bytes_transferred));
+				(m_data->cache_capacity() - m_data->cache_write_position())),
+			make_custom_alloc_handler(m_read_memory,
+				boost::bind(&tcp_session::handle_read, this, 
+					boost::asio::placeholders::error, 
+					boost::asio::placeholders::bytes_transferred)));
 	}
 
 	void tcp_session::handle_read(const boost::system::error_code& ec, size_t bytes_transferred)
 	{
+		m_handler_calls.fetch_add(1, std::memory_order_relaxed);
+
 		if(!ec)  
 		{
-			m_data->cache_write_position() += bytes_transferred;
-
-			//new handle begin
-			while(true){
-				std::string error;
-				uint32_t read_size = this->read_msg(
-					(m_data->cache_buffer() + m_data->cache_read_position()),
-					(m_data->cache_write_position() - m_data->cache_read_position()),
-					error);
-				//std::cout<<"read size:"<<read_size<<endl;
-				if(!error.empty()) {
-					this->caught_error(error);
-					this->start_close();
-					return;
-				}
-				else if(read_size != 0){
-					m_data->cache_read_position() += read_size;
-					//std::cout<<"decoded not empty, continue!"<<std::endl;
-				}
-				else{
-					// read_size == 0;
-					//std::cout<<"decoded empty, break!"<<std::endl;
-					break;
-				}
+			m_data->last_read_tick(m_data->ticks());
+
+#if defined(TCP_QUICKACK)
+			if(m_data->socket_options().quickack){
+				// the kernel falls back to delayed acks after a while, ask again.
+				boost::system::error_code quickack_ec;
+				m_data->socket()->set_option(quick_ack(true), quickack_ec);
+			}
+#endif
+			if(!consume(bytes_transferred)){
+				return;
 			}
 
-			if(m_data->cache_write_position() == m_data->cache_read_position()){
-				//do not need memory move, just reset r/w position.
-				m_data->cache_write_position(0);
-				m_data->cache_read_position(0);
-				//std::cout<<"reset R/W position"<<std::endl;
-			}else{
-				//std::cout<<"before memory move"<<std::endl;
-				::memmove(m_data->cache_buffer(), 
-					m_data->cache_buffer() + m_data->cache_read_position(), 
-					(m_data->cache_write_position() - m_data->cache_read_position()));
-				m_data->cache_write_position(m_data->cache_write_position() - m_data->cache_read_position());
-				m_data->cache_read_position(0);
+			// the socket is non-blocking in drain mode: take what else has arrived
+			// before going back to the reactor.
+			if(m_data->socket()->non_blocking() && !drain()){
+				return;
 			}
-			
-			//end of new handle
+
 			start_read();
 		}
 		else if (ec != boost::asio::error::operation_aborted)
@@ -241,6 +497,107 @@ namespace net {
 		return;  
 	}
 
+	bool tcp_session::consume(size_t bytes_transferred)
+	{
+		// judged against the whole buffer: behind a partial frame the free space
+		// can be a few bytes, and filling that says nothing about the stream.
+		bool filled = bytes_transferred >= m_data->cache_capacity() / 2;
+		m_data->cache_write_position() += bytes_transferred;
+
+		//new handle begin
+		while(true){
+			std::string error;
+			uint32_t read_size = this->read_msg(
+				(m_data->cache_buffer() + m_data->cache_read_position()),
+				(m_data->cache_write_position() - m_data->cache_read_position()),
+				error);
+			//std::cout<<"read size:"<<read_size<<endl;
+			if(!error.empty()) {
+				this->caught_error(error);
+				this->start_close();
+				return false;
+			}
+			else if(read_size != 0){
+				m_data->cache_read_position() += read_size;
+				//std::cout<<"decoded not empty, continue!"<<std::endl;
+			}
+			else{
+				// read_size == 0;
+				//std::cout<<"decoded empty, break!"<<std::endl;
+				break;
+			}
+		}
+
+		if(m_data->cache_write_position() == m_data->cache_read_position()){
+			//do not need memory move, just reset r/w position.
+			m_data->cache_write_position(0);
+			m_data->cache_read_position(0);
+			//std::cout<<"reset R/W position"<<std::endl;
+		}else{
+			//std::cout<<"before memory move"<<std::endl;
+			::memmove(m_data->cache_buffer(), 
+				m_data->cache_buffer() + m_data->cache_read_position(), 
+				(m_data->cache_write_position() - m_data->cache_read_position()));
+			m_data->cache_write_position(m_data->cache_write_position() - m_data->cache_read_position());
+			m_data->cache_read_position(0);
+		}
+		
+		//end of new handle
+
+		adapt_read_buffer(filled, bytes_transferred);
+		return true;
+	}
+
+	bool tcp_session::drain()
+	{
+		for(int i = 0; i < max_drain_reads; i++){
+			boost::system::error_code ec;
+			size_t n = m_data->socket()->read_some(
+				boost::asio::buffer(
+					(m_data->cache_buffer() + m_data->cache_write_position()),
+					(m_data->cache_capacity() - m_data->cache_write_position())),
+				ec);
+
+			if(ec == boost::asio::error::would_block){
+				return true;
+			}
+			if(ec){
+				this->caught_error(ec.message());
+				this->start_close();
+				return false;
+			}
+			if(!consume(n)){
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void tcp_session::adapt_read_buffer(bool filled, size_t bytes_transferred)
+	{
+		uint32_t capacity = m_data->cache_capacity();
+
+		if(filled){
+			// more is probably waiting, read more per call.
+			m_data->sparse_reads(0);
+			if(capacity < m_data->read_buffer_limit()){
+				m_data->resize_cache(std::min<uint32_t>(capacity * 2, m_data->read_buffer_limit()));
+			}
+		}
+		else if(capacity > m_data->cache_size() && bytes_transferred < capacity / 8){
+			// a stream that went quiet gives the memory back, never below cache_size.
+			m_data->sparse_reads(m_data->sparse_reads() + 1);
+			uint32_t smaller = std::max<uint32_t>(capacity / 2, m_data->cache_size());
+			if(m_data->sparse_reads() >= shrink_after_sparse_reads && m_data->cache_write_position() <= smaller){
+				m_data->sparse_reads(0);
+				m_data->resize_cache(smaller);
+			}
+		}
+		else{
+			m_data->sparse_reads(0);
+		}
+	}
+
 	uint32_t tcp_session::read_msg(uint8_t* buf, uint32_t buf_size, std::string& error)
 	{
 		if(buf_size <= m_data->header_length() ){
@@ -251,6 +608,12 @@ namespace net {
 		uint32_t read_len = 0;
 		uint32_t msg_len = check_msg_len(buf, buf_size);//big endian (network byte order).
 
+		bool compressed = false;
+		if(m_data->compress_threshold() != 0 && (msg_len & compressed_flag) != 0){
+			compressed = true;
+			msg_len &= ~compressed_flag;
+		}
+
 		if(msg_len <= m_data->header_length() || msg_len > m_data->cache_size()){
 			error = "invalid msg length:" + boost::lexical_cast<std::string, uint32_t>(msg_len);
 			return 0;
@@ -270,9 +633,13 @@ namespace net {
 			//we can read at least one message.
 			read_len = msg_len;
 			//Utils::hex_dump(data,m_datasize);
-			buffer_ptr bufp(new buffer_type(buf + m_data->read_skip_length(), msg_len - m_data->read_skip_length()));
-
-			on_message(bufp);
+			if(compressed){
+				if(!inflate_frame(buf + m_data->read_skip_length(), msg_len - m_data->read_skip_length(), error)){
+					return 0;
+				}
+			}else{
+				on_frame(buf + m_data->read_skip_length(), msg_len - m_data->read_skip_length());
+			}
 		}else{
 			//wait for more data.
 			read_len = 0;
@@ -305,7 +672,48 @@ namespace net {
 		return ret;
 	}
 
-	void tcp_session::on_message(boost::shared_ptr<buffer_type> msg_buffer)
+	void tcp_session::on_frame(const uint8_t* data, uint32_t size)
+	{
+		if(m_data->on_frame_handler() != nullptr) {
+			// straight from the read cache, only valid during the call.
+			m_data->on_frame_handler()(data, size);
+			return;
+		}
+
+		buffer_ptr bufp(new buffer_type((uint8_t*)data, size));
+		on_message(bufp);
+	}
+
+	bool tcp_session::inflate_frame(const uint8_t* data, uint32_t size, std::string& error)
+	{
+		if(size < sizeof(uint32_t)){
+			error = "invalid compressed msg length:" + boost::lexical_cast<std::string, uint32_t>(size);
+			return false;
+		}
+
+		uint32_t raw_len = check_msg_len((uint8_t*)data, size);
+		if(raw_len > m_data->cache_size()){
+			error = "invalid uncompressed msg length:" + boost::lexical_cast<std::string, uint32_t>(raw_len);
+			return false;
+		}
+
+		// the same bound as uncompressed frames, so it is sized once per session.
+		std::vector<uint8_t>& inflated = m_data->inflate_buffer();
+		if(inflated.size() < m_data->cache_size()){
+			inflated.resize(m_data->cache_size());
+		}
+
+		int32_t len = lz4_block::decompress(data + sizeof(uint32_t), size - sizeof(uint32_t), inflated.data(), raw_len);
+		if(len < 0 || (uint32_t)len != raw_len){
+			error = "corrupted compressed msg.";
+			return false;
+		}
+
+		on_frame(inflated.data(), raw_len);
+		return true;
+	}
+
+	void tcp_session::on_message(const buffer_ptr& msg_buffer)
 	{
 		//std::cout << "response:" << std::string(msg_buffer->getRawBuf().begin(), msg_buffer->getRawBuf().end()) << std::endl;
 
@@ -314,40 +722,118 @@ namespace net {
 		}
 	}
 
-	void tcp_session::start_write(boost::shared_ptr<buffer_type> snd_buffer)
+	tcp_session::buffer_ptr tcp_session::compress_frame(const buffer_ptr& frame)
+	{
+		std::vector<uint8_t>& raw = frame->getRawBuf();
+		uint32_t header_len = m_data->read_skip_length();
+
+		if(m_data->compress_threshold() == 0 || raw.size() < header_len + m_data->compress_threshold()){
+			return frame;
+		}
+
+		// header as built (length and magic key), then the raw payload length and the block.
+		uint32_t raw_len = raw.size() - header_len;
+		buffer_ptr out(new buffer_type(0));
+		out->resize(header_len + sizeof(uint32_t) + lz4_block::bound(raw_len));
+
+		memcpy(out->data(), raw.data(), header_len);
+		out->putInt(raw_len, header_len);
+		uint32_t len = header_len + sizeof(uint32_t)
+			+ lz4_block::compress(raw.data() + header_len, raw_len, out->data() + header_len + sizeof(uint32_t));
+
+		if(len >= raw.size()){
+			// incompressible, the plain frame is cheaper for both ends.
+			return frame;
+		}
+
+		out->resize(len);
+		out->putInt(len | compressed_flag, 0);
+		out->setWritePos(len);
+		return out;
+	}
+
+	void tcp_session::start_write(const buffer_ptr& snd_buffer)
+	{
+		outbound frame = { snd_buffer, slab_ptr() };
+		queue_write(frame);
+	}
+
+	void tcp_session::start_write_slabs(const slab_ptr& snd_slabs)
+	{
+		outbound frame = { buffer_ptr(), snd_slabs };
+		queue_write(frame);
+	}
+
+	void tcp_session::queue_write(const outbound& frame)
 	{
 		bool write_in_progress = !m_data->outbox().empty();
-		m_data->outbox().push_back(snd_buffer);
+		m_data->outbox().push_back(frame);
 		if (!write_in_progress)
 		{
 			// not in write progress
 			//std::cout << "request:" << std::string(snd_buffer->begin() + 4, snd_buffer->end()) << ", outbox:" << m_data->outbox().size() << std::endl;
 
-			// cancel heartbeat sending.
-			m_data->heartbeat_timer()->cancel();
+			write_front();
+		}
+	}
+
+	void tcp_session::write_front()
+	{
+		// whatever piled up while the last write was in flight goes out together, one
+		// gather write (one syscall or one submission) instead of one per frame.
+		std::deque<outbound>& outbox = m_data->outbox();
+		m_write_buffers.clear();
+		m_write_frames = 0;
 
-			boost::asio::async_write(*m_data->socket(),
-				boost::asio::buffer(snd_buffer->getRawBuf()),
-				boost::bind(&tcp_session::handle_write, shared_from_this(), boost::asio::placeholders::error));
+		for (size_t i = 0; i < outbox.size(); i++)
+		{
+			const outbound& frame = outbox[i];
+			if (frame.slabs)
+			{
+				// straight from the shared slabs.
+				const std::vector<slab_buffer::slice>& slices = frame.slabs->slices();
+				if (m_write_frames > 0 && m_write_buffers.size() + slices.size() > max_write_buffers) {
+					break;
+				}
+				for (size_t s = 0; s < slices.size(); s++) {
+					m_write_buffers.push_back(boost::asio::const_buffer(slices[s].block->data() + slices[s].offset, slices[s].length));
+				}
+			}
+			else
+			{
+				if (m_write_buffers.size() >= max_write_buffers) {
+					break;
+				}
+				m_write_buffers.push_back(boost::asio::buffer(frame.buffer->getRawBuf()));
+			}
+			m_write_frames++;
 		}
+
+		write_buffers_view view = { m_write_buffers.data(), m_write_buffers.data() + m_write_buffers.size() };
+		boost::asio::async_write(*m_data->socket(),
+			view,
+			make_custom_alloc_handler(m_write_memory,
+				boost::bind(&tcp_session::handle_write, this, boost::asio::placeholders::error)));
 	}
 
 	void tcp_session::handle_write(const boost::system::error_code& ec)
 	{
+		m_handler_calls.fetch_add(1, std::memory_order_relaxed);
+
 		if (!ec)
 		{
 			//std::cout << "send msg complete." << std::endl;
-			m_data->outbox().pop_front();
+			for (size_t i = 0; i < m_write_frames; i++) {
+				m_outbox_bytes -= frame_size(m_data->outbox().front());
+				m_data->outbox().pop_front();
+			}
+
+			// the heartbeat counts quiet time from here.
+			m_data->last_write_tick(m_data->ticks());
+
 			if (!m_data->outbox().empty())
 			{
-				boost::asio::async_write(*m_data->socket(),
-					boost::asio::buffer(m_data->outbox().front()->getRawBuf()),
-					boost::bind(&tcp_session::handle_write, shared_from_this(), boost::asio::placeholders::error)); 
-			}
-			else {
-				// Wait before sending the next heartbeat or customer message.
-				m_data->heartbeat_timer()->expires_from_now(boost::posix_time::seconds(m_data->heartbeat_interval()));
-				m_data->heartbeat_timer()->async_wait(boost::bind(&tcp_session::send_heartbeat, shared_from_this(), boost::asio::placeholders::error));
+				write_front();
 			}
 		}
 		else if (ec != boost::asio::error::operation_aborted)
@@ -359,6 +845,8 @@ namespace net {
 
 	void tcp_session::check_deadline(const boost::system::error_code& ec)
 	{
+		m_handler_calls.fetch_add(1, std::memory_order_relaxed);
+
 		if (!m_data->connected() && !m_data->connecting()) {
 			return;
 		}
@@ -383,7 +871,8 @@ namespace net {
 			else
 			{
 				// Put the actor back to sleep.
-				m_data->deadline()->async_wait(boost::bind(&tcp_session::check_deadline, shared_from_this(), boost::asio::placeholders::error));
+				m_data->deadline()->async_wait(make_custom_alloc_handler(m_deadline_memory,
+					boost::bind(&tcp_session::check_deadline, this, boost::asio::placeholders::error)));
 			}
 		}
 		else {
@@ -392,20 +881,94 @@ namespace net {
 		}
 	}
 
-	void tcp_session::send_heartbeat(const boost::system::error_code& ec)
+	void tcp_session::start_tick()
 	{
-		if (!ec)
-		{
-			bool write_in_progress = !m_data->outbox().empty();
-			if (!write_in_progress)
-			{
-				// std::cout << "send heartbeart" << std::endl;
-				start_write(m_data->heartbeat_buffer());
-			}
+		m_data->tick_timer()->async_wait(make_custom_alloc_handler(m_tick_memory,
+			boost::bind(&tcp_session::handle_tick, this, boost::asio::placeholders::error)));
+	}
+
+	void tcp_session::handle_tick(const boost::system::error_code& ec)
+	{
+		m_handler_calls.fetch_add(1, std::memory_order_relaxed);
+
+		if (ec == boost::asio::error::operation_aborted) {
+			// closing.
+			return;
 		}
-		else if (ec != boost::asio::error::operation_aborted) {
+		if (ec) {
 			this->caught_error(ec.message());
 			this->start_close();
+			return;
+		}
+
+		uint32_t ticks = m_data->ticks() + 1;
+		m_data->ticks(ticks);
+
+		uint32_t timeout = m_data->read_timeout();
+		if (timeout != 0 && ticks - m_data->last_read_tick() >= timeout / tick_seconds)
+		{
+			caught_error("connection timeout.");
+			start_close();
+			return;
+		}
+
+		uint32_t interval = m_data->heartbeat_interval();
+		bool write_in_progress = !m_data->outbox().empty();
+		if (interval != 0 && !write_in_progress && m_data->heartbeat_buffer() != nullptr
+			&& ticks - m_data->last_write_tick() >= interval / tick_seconds)
+		{
+			// std::cout << "send heartbeart" << std::endl;
+			m_outbox_bytes += m_data->heartbeat_buffer()->getRawBuf().size();
+			start_write(m_data->heartbeat_buffer());
+		}
+
+		// off the previous expiry, so the tick does not drift.
+		m_data->tick_timer()->expires_at(m_data->tick_timer()->expires_at() + boost::posix_time::seconds(tick_seconds));
+		start_tick();
+	}
+
+	void tcp_session::set_heartbeat(const buffer_ptr& frame, uint32_t interval)
+	{
+		if (frame != nullptr) {
+			m_data->heartbeat_buffer(frame);
+		}
+		m_data->heartbeat_interval(interval);
+	}
+
+	void tcp_session::start_call_timer(boost::posix_time::ptime at)
+	{
+		if (m_data->call_timer() == nullptr) {
+			return;
+		}
+
+		// already due no later than that.
+		if (m_data->call_timer_armed() && m_data->call_timer()->expires_at() <= at) {
+			return;
+		}
+
+		// moving the expiry aborts the earlier wait.
+		m_data->call_timer_armed(true);
+		m_data->call_timer()->expires_at(at);
+		m_data->call_timer()->async_wait(make_custom_alloc_handler(m_call_timer_memory,
+			boost::bind(&tcp_session::handle_call_timer, this, boost::asio::placeholders::error)));
+	}
+
+	void tcp_session::handle_call_timer(const boost::system::error_code& ec)
+	{
+		m_handler_calls.fetch_add(1, std::memory_order_relaxed);
+
+		if (ec == boost::asio::error::operation_aborted) {
+			// re-armed earlier, or closing.
+			return;
+		}
+
+		m_data->call_timer_armed(false);
+
+		if (!ec && m_data->on_call_timer_handler() != nullptr) {
+			boost::posix_time::ptime next = m_data->on_call_timer_handler()();
+			if (!next.is_not_a_date_time()) {
+				start_call_timer(next);
+			}
 		}
 	}
 
@@ -437,14 +1000,19 @@ namespace net {
 		m_data->io_service()->stop();
 
 		m_data->deadline()->cancel();
-		m_data->heartbeat_timer()->cancel();
+		m_data->tick_timer()->cancel();
+		m_data->call_timer()->cancel();
+		m_data->call_timer_armed(false);
 
 		m_data->io_service().reset();
 		m_data->socket().reset();
 		m_data->strand().reset();
 		m_data->deadline().reset();
-		m_data->heartbeat_timer().reset();
-		m_data->heartbeat_buffer().reset();
+		m_data->tick_timer().reset();
+		m_data->call_timer().reset();
+
+		// whatever was queued is dropped with the socket.
+		m_outbox_bytes = 0;
 
 		on_closed();
 	}
@@ -458,6 +1026,11 @@ namespace net {
 		}
 	}
 
+	size_t tcp_session::frame_size(const outbound& frame)
+	{
+		return frame.slabs ? frame.slabs->size() : frame.buffer->getRawBuf().size();
+	}
+
 	void tcp_session::caught_error(const std::string& error)
 	{
 		//std::cerr << "Error: " << error << std::endl;
@@ -2,28 +2,95 @@
 #define __TCP_SESSION_H__
 
 #include <boost/asio.hpp> 
-#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/smart_ptr/intrusive_ref_counter.hpp>
 #include "../byte_buffer.h"
+#include "../slab_buffer.h"
+#include "handler_memory.h"
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <atomic>
+#include <functional>
 
 namespace net {
 
 	class tcp_session_data;
 
+	// The io thread holds a reference for as long as it runs the session's io_service,
+	// and handlers only ever run inside that, so they bind the raw session pointer
+	// instead of touching the refcount on every read, write and timer.
 	class tcp_session  
-		: public boost::enable_shared_from_this<tcp_session> 
+		: public boost::intrusive_ref_counter<tcp_session> 
 	{
 	public:
-		typedef boost::shared_ptr<tcp_session>    ptr;
+		typedef boost::intrusive_ptr<tcp_session> ptr;
 		typedef byte_buffer                       buffer_type;
-		typedef boost::shared_ptr<buffer_type>    buffer_ptr;
+		typedef boost::intrusive_ptr<buffer_type> buffer_ptr;
+		typedef slab_buffer::ptr                  slab_ptr;
+
+		// a queued frame, either contiguous or a chain of shared slab slices.
+		struct outbound {
+			buffer_ptr buffer;
+			slab_ptr   slabs;
+		};
+
+		// applied to the socket before it connects; zero or false leaves the system default.
+		struct socket_options {
+			bool nodelay;   // TCP_NODELAY
+			bool quickack;  // TCP_QUICKACK, Linux only; not sticky, so renewed after every read
+			int  sndbuf;    // SO_SNDBUF, bytes
+			int  rcvbuf;    // SO_RCVBUF, bytes
+			int  busy_poll; // SO_BUSY_POLL, microseconds, Linux only
+
+			socket_options() : nodelay(false), quickack(false), sndbuf(0), rcvbuf(0), busy_poll(0) {}
+		};
+
+		// how the io thread waits for work, fixed when connect() starts it.
+		struct io_options {
+			uint32_t spin_us; // poll for ready handlers this long before blocking, 0 blocks at once
+			int      cpu;     // pin the io thread to this cpu, -1 takes the next of net.setIoCpus if any; Linux only
+
+			io_options() : spin_us(0), cpu(-1) {}
+		};
+
+		// set in the length word of a frame whose payload is [raw length:4][lz4 block].
+		static const uint32_t compressed_flag = 0x80000000;
 
 	public:
 		virtual tcp_session& connect();
-		virtual tcp_session& send(boost::shared_ptr<buffer_type> snd_buf);
+		virtual tcp_session& send(const buffer_ptr& snd_buf);
+		virtual tcp_session& send(const slab_ptr& frame); // written as is, never compressed
+		virtual tcp_session& enqueue(const buffer_ptr& frame); // written as is, never compressed
+
+		// frame as send() would write it: compressed if enabled and worth it, else frame itself.
+		virtual buffer_ptr compress_frame(const buffer_ptr& frame);
 		virtual tcp_session& close();
 
 		virtual bool io_service_stopped();
 
+		// bytes handed to send() and not written yet, readable from any thread.
+		size_t outbox_bytes() const;
+
+		// completion handlers run so far (connect, reads, writes, timers), from any thread.
+		uint64_t handler_calls() const;
+
+		// times the io thread found nothing to do within its spin budget and blocked, from any thread.
+		uint64_t io_sleeps() const;
+
+		// frame written after interval seconds without writes, 0 stops heartbeats. From any thread.
+		virtual tcp_session& heartbeat(const buffer_ptr& frame, uint32_t interval);
+
+		// run handler on the io thread, false if the session is not running. From any thread.
+		virtual bool post(const std::function<void()>& handler);
+
+		// make sure the call timer fires no later than at, from any thread.
+		virtual tcp_session& schedule_call_timer(boost::posix_time::ptime at);
+
+		// blocks until every io thread started by connect() has returned from run(), so no
+		// handler is running or will run. Returns at once on the session's own io thread.
+		void wait_io_threads();
+
 		tcp_session_data& data();
 
 	public:
@@ -31,30 +98,81 @@ namespace net {
 		virtual ~tcp_session();
 
 	protected:
+		static void run(ptr session, boost::shared_ptr<boost::asio::io_service> io_service, io_options options);
+		void io_thread_exited();
+
 		virtual void start_connect(boost::asio::ip::tcp::resolver::iterator endpoint_iter);
+		virtual void apply_socket_options();
 		virtual void handle_connect(const boost::system::error_code& ec, boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
 		virtual void on_connected(boost::asio::ip::tcp::endpoint endpoint);
 		
 		virtual void start_read();
 		virtual void handle_read(const boost::system::error_code& error, size_t bytes_transferred);
+		virtual bool consume(size_t bytes_transferred); // false if the session was closed
+		virtual bool drain();
+		virtual void adapt_read_buffer(bool filled, size_t bytes_transferred);
 		virtual uint32_t read_msg(uint8_t* buf, uint32_t buf_size, std::string& error);
 		virtual uint32_t check_msg_len(uint8_t* buf, uint32_t buf_size);
 		virtual uint32_t check_magic_key(uint8_t* buf, uint32_t buf_size);
-		virtual void on_message(boost::shared_ptr<buffer_type> rcv_buf);
+		virtual void on_frame(const uint8_t* data, uint32_t size);
+		virtual bool inflate_frame(const uint8_t* data, uint32_t size, std::string& error);
+		virtual void on_message(const buffer_ptr& rcv_buf);
 		
-		virtual void start_write(boost::shared_ptr<buffer_type> snd_buf);
+		virtual void start_write(const buffer_ptr& snd_buf);
+		virtual void start_write_slabs(const slab_ptr& frame);
+		virtual void queue_write(const outbound& frame);
+		virtual void write_front();
 		virtual void handle_write(const boost::system::error_code& ec);
 
 		virtual void start_close();
 		virtual void on_closed();
 
 		virtual void check_deadline(const boost::system::error_code& ec);
-		virtual void send_heartbeat(const boost::system::error_code& ec);
+		virtual void start_tick();
+		virtual void handle_tick(const boost::system::error_code& ec);
+		virtual void set_heartbeat(const buffer_ptr& frame, uint32_t interval);
+		virtual void start_call_timer(boost::posix_time::ptime at);
+		virtual void handle_call_timer(const boost::system::error_code& ec);
 
 		virtual void caught_error(const std::string& error);
+
+		static size_t frame_size(const outbound& frame);
+
+		// a buffer sequence over m_write_buffers; asio copies the sequence into the write
+		// operation, a view keeps that copy two pointers long.
+		struct write_buffers_view {
+			typedef boost::asio::const_buffer value_type;
+			typedef const boost::asio::const_buffer* const_iterator;
+
+			const_iterator first;
+			const_iterator last;
+
+			const_iterator begin() const { return first; }
+			const_iterator end() const { return last; }
+		};
 		
 	protected:
 		boost::shared_ptr<tcp_session_data> m_data;
+
+		// one outstanding operation of each kind, so their handlers never hit the heap.
+		handler_memory m_read_memory;
+		handler_memory m_write_memory;
+		handler_memory m_deadline_memory;
+		handler_memory m_tick_memory;
+		handler_memory m_call_timer_memory;
+
+		// the batch being written: every queued frame that fit, at most max_write_buffers.
+		std::vector<boost::asio::const_buffer> m_write_buffers;
+		size_t m_write_frames;
+
+		std::atomic<size_t> m_outbox_bytes;
+		std::atomic<uint64_t> m_handler_calls;
+		std::atomic<uint64_t> m_io_sleeps;
+
+		// io threads that have not returned from run() yet.
+		boost::mutex m_io_threads_mutex;
+		boost::condition_variable m_io_threads_done;
+		size_t m_io_threads;
 	};
 }; // namespace net
 
@@ -4,25 +4,37 @@
 namespace net {
 
 	tcp_session_data::tcp_session_data(uint32_t read_cache_size)
-		:m_cache_size(read_cache_size)
+		:m_connected(false)
+		,m_connecting(false)
+		,m_call_timer_armed(false)
+		,m_connect_timeout(60)
+		,m_read_timeout(60)
+		,m_heartbeat_interval(30)
+		,m_ticks(0)
+		,m_last_write_tick(0)
+		,m_last_read_tick(0)
+		,m_magic_key(0)
+		,m_io_cpu(-1)
+		,m_heartbeat_buffer(nullptr)
+		,m_cache_size(read_cache_size)
 		,m_cache_buffer(nullptr)
 		,m_cache_write_position(0)
 		,m_cache_read_position(0)
-		,m_connected(false)
-		,m_connecting(false)
-		,m_connect_timeout(60)
-		,m_read_timeout(60)
-		,m_heartbeat_interval(30)
-		,m_heartbeat_buffer(nullptr)
-		,m_magic_key(0)
+		,m_read_buffer_limit(read_cache_size * 8)
+		,m_sparse_reads(0)
+		,m_read_drain(false)
 		,m_header_length(0)
 		,m_read_skip_length(0)
+		,m_compress_threshold(0)
 		,m_on_connected_handler(nullptr)
-		,m_on_message_handler(nullptr)
 		,m_on_closed_handler(nullptr)
+		,m_on_message_handler(nullptr)
+		,m_on_frame_handler(nullptr)
 		,m_on_error_handler(nullptr)
+		,m_on_call_timer_handler(nullptr)
 	{
 		m_cache_buffer = (uint8_t*)malloc(m_cache_size * sizeof(uint8_t));
+		m_cache_capacity = m_cache_size;
 	}
 
 	tcp_session_data::~tcp_session_data()
@@ -35,10 +47,45 @@ namespace net {
 		m_socket.reset();
 		m_strand.reset();
 		m_deadline.reset();
-		m_heartbeat_timer.reset();
+		m_tick_timer.reset();
+		m_call_timer.reset();
 		m_heartbeat_buffer.reset();
 		m_outbox.clear();
 	}
 
+	bool tcp_session_data::resize_cache(uint32_t capacity)
+	{
+		if (capacity == m_cache_capacity) {
+			return true;
+		}
+
+		uint8_t* buffer = (uint8_t*)realloc(m_cache_buffer, capacity * sizeof(uint8_t));
+		if (buffer == nullptr) {
+			return false;
+		}
+
+		m_cache_buffer = buffer;
+		m_cache_capacity = capacity;
+		return true;
+	}
+
+	void tcp_session_data::reset()
+	{
+		m_connected = false;
+		m_connecting = false;
+		m_call_timer_armed = false;
+		m_host.clear();
+		m_port = 0;
+		m_cache_write_position = 0;
+		m_cache_read_position = 0;
+		m_sparse_reads = 0;
+		resize_cache(m_cache_size);
+		m_outbox.clear();
+		m_applied_socket_options = tcp_session::socket_options();
+		m_io_cpu = -1;
+		m_inflate_buffer.clear();
+		m_inflate_buffer.shrink_to_fit();
+	}
+
 
 }//namespace net
\ No newline at end of file
@@ -3,7 +3,9 @@
 
 #include "../stream_property.h"
 #include "tcp_session.h"
+#include <boost/enable_shared_from_this.hpp>
 #include <deque>
+#include <vector>
 
 namespace net {
 
@@ -16,8 +18,10 @@ namespace net {
 
 		typedef std::function<void(std::string)>               on_connected_handler_type;
 		typedef std::function<void(tcp_session::buffer_ptr)>   on_message_handler_type;
+		typedef std::function<void(const uint8_t*, uint32_t)>  on_frame_handler_type;
 		typedef std::function<void(void)>                      on_closed_handler_type;
 		typedef std::function<void(std::string)>               on_error_handler_type;
+		typedef std::function<boost::posix_time::ptime(void)>  on_call_timer_handler_type; // returns the next deadline
 
 
 	public:
@@ -31,35 +35,77 @@ namespace net {
 		STREAM_PROPERTY(boost::shared_ptr<boost::asio::ip::tcp::socket>, socket);
 		STREAM_PROPERTY(boost::shared_ptr<boost::asio::io_service::strand>, strand);
 		STREAM_PROPERTY(boost::shared_ptr<boost::asio::deadline_timer>, deadline);
-		STREAM_PROPERTY(boost::shared_ptr<boost::asio::deadline_timer>, heartbeat_timer);
+		STREAM_PROPERTY(boost::shared_ptr<boost::asio::deadline_timer>, tick_timer);
+		STREAM_PROPERTY(boost::shared_ptr<boost::asio::deadline_timer>, call_timer);
+		STREAM_PROPERTY(bool, call_timer_armed);
 
 		STREAM_PROPERTY(uint32_t, connect_timeout);
-		STREAM_PROPERTY(uint32_t, read_timeout);
-		STREAM_PROPERTY(uint32_t, heartbeat_interval);
+		STREAM_PROPERTY(uint32_t, read_timeout); // seconds, 0 is none
+		STREAM_PROPERTY(uint32_t, heartbeat_interval); // seconds without writes before a heartbeat, 0 is off
+
+		// coarse clock of the io thread, counted by the session tick. Reads and writes
+		// only note the tick they completed in; the tick decides when a heartbeat is due
+		// and when the peer has been silent for longer than read_timeout.
+		STREAM_PROPERTY(uint32_t, ticks);
+		STREAM_PROPERTY(uint32_t, last_write_tick);
+		STREAM_PROPERTY(uint32_t, last_read_tick);
 
 		STREAM_PROPERTY(uint32_t, magic_key);
 
+		STREAM_PROPERTY(tcp_session::socket_options, socket_options);
+		STREAM_PROPERTY(tcp_session::socket_options, applied_socket_options); // as read back once set, before connecting
+		STREAM_PROPERTY(tcp_session::io_options, io_options);
+		STREAM_PROPERTY(int, io_cpu); // cpu the io thread was pinned to on this connection, -1 for none
+
 		STREAM_PROPERTY(tcp_session::buffer_ptr, heartbeat_buffer);
 
-		STREAM_CONST_PROPERTY(uint32_t, cache_size);
+		STREAM_CONST_PROPERTY(uint32_t, cache_size); // the largest frame, and the smallest read buffer
 
 		STREAM_PROPERTY(uint8_t*, cache_buffer);
 		STREAM_PROPERTY(uint32_t, cache_write_position);
 		STREAM_PROPERTY(uint32_t, cache_read_position);
 
+		// the read buffer doubles, up to read_buffer_limit, while reads fill it, and
+		// halves back towards cache_size once they stay small.
+		STREAM_PROPERTY(uint32_t, read_buffer_limit);
+		STREAM_PROPERTY(uint32_t, sparse_reads);
+
+		// read until EAGAIN after each completion; applied when the socket is opened.
+		STREAM_PROPERTY(bool, read_drain);
+
 		STREAM_PROPERTY(uint32_t, header_length);
 		STREAM_PROPERTY(uint32_t, read_skip_length);
 
-		STREAM_PROPERTY(std::deque<tcp_session::buffer_ptr>, outbox);
+		// frames with at least this many payload bytes are sent compressed, 0 is off.
+		// Compressed frames are only accepted while it is on, so both ends opt in.
+		STREAM_PROPERTY(uint32_t, compress_threshold);
+		STREAM_PROPERTY(std::vector<uint8_t>, inflate_buffer);
+
+		STREAM_PROPERTY(std::deque<tcp_session::outbound>, outbox);
 
 		STREAM_PROPERTY(on_connected_handler_type, on_connected_handler);
 		STREAM_PROPERTY(on_closed_handler_type, on_closed_handler);
 		STREAM_PROPERTY(on_message_handler_type, on_message_handler);
+		STREAM_PROPERTY(on_frame_handler_type, on_frame_handler);
 		STREAM_PROPERTY(on_error_handler_type, on_error_handler);
+		STREAM_PROPERTY(on_call_timer_handler_type, on_call_timer_handler);
+
+	public:
+		// bytes allocated for the read buffer, at least cache_size.
+		uint32_t cache_capacity() const { return m_cache_capacity; }
+
+		// reallocate the read buffer, keeping its contents; false if out of memory.
+		bool resize_cache(uint32_t capacity);
+
+		// back to the unconnected state, keeping the read cache and the handlers.
+		void reset();
 
 	public:
 		tcp_session_data(uint32_t read_cache_size = 8192);
 		~tcp_session_data();
+
+	private:
+		uint32_t m_cache_capacity;
 	};
 }// namespace net
 
@@ -0,0 +1,77 @@
+#include "tcp_session_pool.h"
+
+namespace net {
+
+	// entries still closing are moved to the back, but only this many are looked at per acquire.
+	static const size_t max_busy_probes = 4;
+
+	tcp_session_pool& tcp_session_pool::instance()
+	{
+		static tcp_session_pool pool;
+		return pool;
+	}
+
+	tcp_session_pool::tcp_session_pool(size_t capacity)
+		:m_capacity(capacity)
+	{
+
+	}
+
+	tcp_session_pool::~tcp_session_pool()
+	{
+		m_entries.clear();
+	}
+
+	bool tcp_session_pool::acquire(tcp_session::ptr& session, tcp_client_data::ptr& data)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		for (size_t i = 0; i < max_busy_probes && i < m_entries.size(); i++) {
+			entry& e = m_entries.front();
+			if (e.session->use_count() == 1) {
+				session.swap(e.session);
+				data.swap(e.data);
+				m_entries.pop_front();
+				return true;
+			}
+
+			// still referenced by a closing io thread, try it again later.
+			m_entries.push_back(e);
+			m_entries.pop_front();
+		}
+		return false;
+	}
+
+	void tcp_session_pool::release(const tcp_session::ptr& session, const tcp_client_data::ptr& data)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		if (m_entries.size() >= m_capacity) {
+			return;
+		}
+
+		entry e = { session, data };
+		m_entries.push_back(e);
+	}
+
+	void tcp_session_pool::capacity(size_t capacity)
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+
+		m_capacity = capacity;
+		while (m_entries.size() > m_capacity) {
+			m_entries.pop_back();
+		}
+	}
+
+	size_t tcp_session_pool::capacity()
+	{
+		return m_capacity;
+	}
+
+	size_t tcp_session_pool::size()
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		return m_entries.size();
+	}
+}; // namespace net
@@ -0,0 +1,46 @@
+#ifndef __TCP_SESSION_POOL_H__
+#define __TCP_SESSION_POOL_H__
+
+#include "tcp_session.h"
+#include "tcp_client_data.h"
+#include <boost/thread/mutex.hpp>
+#include <deque>
+
+namespace net {
+
+	// Keeps the session state of collected clients (session, session data with its
+	// read cache, client data and the handler wiring between them) for reuse, so a
+	// new client in steady state allocates none of it.
+	class tcp_session_pool
+	{
+	public:
+		static tcp_session_pool& instance();
+
+		// false if no released entry is idle yet; an entry is idle once the io
+		// thread has dropped its last handler referencing the session.
+		bool acquire(tcp_session::ptr& session, tcp_client_data::ptr& data);
+
+		// data and session must already be reset.
+		void release(const tcp_session::ptr& session, const tcp_client_data::ptr& data);
+
+		void capacity(size_t capacity);
+		size_t capacity();
+		size_t size();
+
+	public:
+		tcp_session_pool(size_t capacity = 64);
+		~tcp_session_pool();
+
+	private:
+		struct entry {
+			tcp_session::ptr session;
+			tcp_client_data::ptr data;
+		};
+
+		boost::mutex m_mutex;
+		std::deque<entry> m_entries;
+		size_t m_capacity;
+	};
+}; // namespace net
+
+#endif //__TCP_SESSION_POOL_H__
@@ -0,0 +1,86 @@
+#include "thread_affinity.h"
+#include <boost/thread/mutex.hpp>
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace net {
+
+	namespace affinity {
+
+		namespace {
+			// -1 until the calling thread has looked up its node.
+			thread_local int t_node = -1;
+
+			struct io_cpus {
+				boost::mutex mutex;
+				std::vector<int> cpus;
+				size_t next;
+			};
+
+			io_cpus& placement()
+			{
+				static io_cpus instance;
+				return instance;
+			}
+		}
+
+		bool pin_current_thread(int cpu)
+		{
+#if defined(__linux__)
+			if (cpu < 0 || cpu >= CPU_SETSIZE) {
+				return false;
+			}
+			cpu_set_t set;
+			CPU_ZERO(&set);
+			CPU_SET(cpu, &set);
+			if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+				return false;
+			}
+			t_node = -1;
+			return true;
+#else
+			(void)cpu;
+			return false;
+#endif
+		}
+
+		int current_node()
+		{
+			if (t_node < 0) {
+				t_node = 0;
+#if defined(__linux__) && defined(SYS_getcpu)
+				unsigned cpu = 0;
+				unsigned node = 0;
+				if (syscall(SYS_getcpu, &cpu, &node, nullptr) == 0) {
+					t_node = (int)node;
+				}
+#endif
+			}
+			return t_node;
+		}
+
+		void set_io_cpus(const std::vector<int>& cpus)
+		{
+			io_cpus& p = placement();
+			boost::mutex::scoped_lock lock(p.mutex);
+			p.cpus = cpus;
+			p.next = 0;
+		}
+
+		int next_io_cpu()
+		{
+			io_cpus& p = placement();
+			boost::mutex::scoped_lock lock(p.mutex);
+			if (p.cpus.empty()) {
+				return -1;
+			}
+			int cpu = p.cpus[p.next % p.cpus.size()];
+			p.next++;
+			return cpu;
+		}
+	}
+}; // namespace net
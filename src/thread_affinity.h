@@ -0,0 +1,28 @@
+#ifndef __THREAD_AFFINITY_H__
+#define __THREAD_AFFINITY_H__
+
+#include <vector>
+
+namespace net {
+
+	// Where io and Lua threads run. Linux only; elsewhere nothing is pinned and every
+	// thread counts as being on node 0.
+	namespace affinity {
+
+		// pin the calling thread to cpu, false if it could not be pinned.
+		bool pin_current_thread(int cpu);
+
+		// NUMA node of the calling thread, looked up once per thread and again after
+		// it is pinned.
+		int current_node();
+
+		// cpus handed out in turn to the io threads of sessions that do not name one;
+		// empty leaves those to the scheduler.
+		void set_io_cpus(const std::vector<int>& cpus);
+
+		// the next of those cpus, -1 if none are set.
+		int next_io_cpu();
+	}
+}; // namespace net
+
+#endif //__THREAD_AFFINITY_H__
@@ -0,0 +1,143 @@
+// byte_buffer's vectorized find, replace and toHex against plain byte loops, on random
+// buffers of every length up to a few blocks and from every start offset, so the scalar
+// tails and unaligned blocks are hit. Built once with the default flags and, where the
+// machine has AVX2, once more as test_byte_buffer_avx2.
+
+#include "../src/byte_buffer.h"
+#include "test_util.h"
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+static int32_t reference_find(const std::vector<uint8_t>& data, const uint8_t* pattern, uint32_t len, uint32_t start)
+{
+	if (start > data.size() || len > data.size() - start) {
+		return -1;
+	}
+	for (size_t i = start; i + len <= data.size(); i++) {
+		if (std::memcmp(&data[i], pattern, len) == 0) {
+			return (int32_t)i;
+		}
+	}
+	return -1;
+}
+
+static void reference_replace(std::vector<uint8_t>& data, uint8_t key, uint8_t rep, uint32_t start, bool first_only)
+{
+	for (size_t i = start; i < data.size(); i++) {
+		if (data[i] == key) {
+			data[i] = rep;
+			if (first_only) {
+				return;
+			}
+		}
+	}
+}
+
+// few distinct values, so patterns match often and partial matches are common.
+static std::vector<uint8_t> random_bytes(size_t len)
+{
+	std::vector<uint8_t> data(len);
+	for (size_t i = 0; i < len; i++) {
+		data[i] = (uint8_t)(std::rand() % 4);
+	}
+	return data;
+}
+
+static byte_buffer make_buffer(const std::vector<uint8_t>& data)
+{
+	return byte_buffer(data.empty() ? NULL : (uint8_t*)&data[0], (uint32_t)data.size());
+}
+
+static void test_find()
+{
+	for (uint32_t len = 0; len <= 100; len++) {
+		std::vector<uint8_t> data = random_bytes(len);
+		byte_buffer buf = make_buffer(data);
+
+		for (uint32_t pattern_len = 0; pattern_len <= 5; pattern_len++) {
+			for (int round = 0; round < 4; round++) {
+				// taken from the buffer, so it is there, or random, so it may not be.
+				uint8_t pattern[5];
+				if (round < 2 && len >= pattern_len) {
+					uint32_t at = len > pattern_len ? std::rand() % (len - pattern_len + 1) : 0;
+					std::memcpy(pattern, data.empty() ? pattern : &data[at], pattern_len);
+				}
+				else {
+					for (uint32_t i = 0; i < pattern_len; i++) {
+						pattern[i] = (uint8_t)(std::rand() % 5);
+					}
+				}
+
+				for (uint32_t start = 0; start <= len + 1; start++) {
+					int32_t expected = reference_find(data, pattern, pattern_len, start);
+					int32_t found = buf.findBytes(pattern, pattern_len, start);
+					if (found != expected) {
+						std::fprintf(stderr, "findBytes len %u pattern %u start %u: %d, expected %d\n",
+							len, pattern_len, start, found, expected);
+					}
+					CHECK_EQ(found, expected);
+				}
+			}
+		}
+	}
+
+	// a zero byte before the key no longer ends the search.
+	uint8_t bytes[] = { 1, 0, 0, 7, 0, 0x34, 0x12 };
+	byte_buffer buf(bytes, sizeof(bytes));
+	CHECK_EQ(buf.find<uint8_t>(7), 3);
+	CHECK_EQ(buf.find<uint16_t>(0x1234), 5);
+	CHECK_EQ(buf.find<uint16_t>(0x1234, 6), -1);
+	CHECK_EQ(buf.find<uint32_t>(0x00070000), 1);
+	CHECK_EQ(buf.find<uint32_t>(0x12340000), -1);
+}
+
+static void test_replace()
+{
+	for (uint32_t len = 0; len <= 100; len++) {
+		for (uint32_t start = 0; start <= len; start++) {
+			for (int first_only = 0; first_only < 2; first_only++) {
+				std::vector<uint8_t> data = random_bytes(len);
+				byte_buffer buf = make_buffer(data);
+
+				uint8_t key = (uint8_t)(std::rand() % 4);
+				buf.replace(key, 0xEE, start, first_only != 0);
+				reference_replace(data, key, 0xEE, start, first_only != 0);
+
+				CHECK_EQ(buf.size(), data.size());
+				CHECK(len == 0 || std::memcmp(buf.data(), &data[0], len) == 0);
+			}
+		}
+	}
+}
+
+static void test_to_hex()
+{
+	std::vector<uint8_t> all(256);
+	for (size_t i = 0; i < all.size(); i++) {
+		all[i] = (uint8_t)i;
+	}
+
+	for (uint32_t len = 0; len <= 256; len += 17) {
+		std::vector<uint8_t> data(all.begin(), all.begin() + len);
+		std::string expected;
+		for (size_t i = 0; i < data.size(); i++) {
+			char word[4];
+			std::snprintf(word, sizeof(word), "%02X ", data[i]);
+			expected += word;
+		}
+		CHECK(make_buffer(data).toHex() == expected);
+	}
+}
+
+int main()
+{
+	std::srand(36);
+
+	test_find();
+	test_replace();
+	test_to_hex();
+
+	return test_result("test_byte_buffer");
+}
@@ -0,0 +1,104 @@
+// Frames decoded for onPacked/onJson handlers on a state with a memory limit: running out
+// of memory while the value is built must reach the error handler, not abort.
+
+#include "../src/tcp/tcp_client_data.h"
+#include "../src/lua_allocator.h"
+#include "../src/lua_util.h"
+#include "test_util.h"
+#include <cstring>
+#include <string>
+
+static int ref_chunk(lua_State* L, const char* chunk)
+{
+	if (luaL_loadstring(L, chunk) != LUA_OK || lua_pcall(L, 0, 1, 0) != LUA_OK) {
+		std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+		return LUA_REFNIL;
+	}
+	return luautil_ref_function(L);
+}
+
+static std::string global_string(lua_State* L, const char* name)
+{
+	lua_getglobal(L, name);
+	const char* s = lua_tostring(L, -1);
+	std::string value = s ? s : "";
+	lua_pop(L, 1);
+	return value;
+}
+
+static void feed(net::tcp_client_data& data, const std::string& frame)
+{
+	data.on_frame((const uint8_t*)frame.data(), (uint32_t)frame.size());
+}
+
+static void test_decode_under_limit(bool json)
+{
+	lua_State* L = luaalloc_newstate(luaalloc_pool, 512 * 1024);
+	luaL_openlibs(L);
+
+	net::tcp_client_data::ptr data(new net::tcp_client_data());
+	data->set_lua_state(L);
+	data->set_on_error_ref(ref_chunk(L, "return function(e) last_error = e end"));
+	int handler = ref_chunk(L, "return function(v) received = type(v) == 'table' and #v or v end");
+	if (json) {
+		data->set_on_json_ref(handler);
+	}
+	else {
+		data->set_on_packed_ref(handler);
+	}
+
+	int top = lua_gettop(L);
+
+	// small enough: the handler gets the value.
+	feed(*data, json ? std::string("[1,2,3]") : std::string("\x93\x01\x02\x03", 4));
+	lua_getglobal(L, "received");
+	CHECK_EQ(lua_tointeger(L, -1), 3);
+	lua_pop(L, 1);
+	CHECK(global_string(L, "last_error").empty());
+
+	// far larger decoded than the limit allows: an array of 100000 distinct strings.
+	std::string big;
+	if (json) {
+		big = "[";
+		for (int i = 0; i < 100000; i++) {
+			big += (i ? ",\"s" : "\"s") + std::to_string(i) + "\"";
+		}
+		big += "]";
+	}
+	else {
+		big = std::string("\xdd\x00\x01\x86\xa0", 5); // array 32, 100000 elements
+		for (int i = 0; i < 100000; i++) {
+			std::string s = "s" + std::to_string(i);
+			big += (char)(0xa0 | s.size());
+			big += s;
+		}
+	}
+	feed(*data, big);
+	CHECK(global_string(L, "last_error").find("out of memory") != std::string::npos);
+	CHECK_EQ(lua_gettop(L), top);
+
+	// not valid at all.
+	lua_pushnil(L);
+	lua_setglobal(L, "last_error");
+	feed(*data, json ? std::string("[1,") : std::string("\x93\x01", 2));
+	CHECK(global_string(L, "last_error").find("invalid") != std::string::npos);
+	CHECK_EQ(lua_gettop(L), top);
+
+	// and the state is still usable.
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	feed(*data, json ? std::string("[1,2,3,4]") : std::string("\x94\x01\x02\x03\x04", 5));
+	lua_getglobal(L, "received");
+	CHECK_EQ(lua_tointeger(L, -1), 4);
+	lua_pop(L, 1);
+
+	data->reset();
+	luaalloc_close(L);
+}
+
+int main()
+{
+	test_decode_under_limit(true);
+	test_decode_under_limit(false);
+
+	return test_result("test_frame_decode");
+}
@@ -0,0 +1,287 @@
+// Echo round trips over loopback with the read, write and timer handlers wrapped the
+// way tcp_session wraps them. Once warmed up, a round trip must not reach operator new.
+
+#include "../src/tcp/handler_memory.h"
+#include "test_util.h"
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <array>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> g_allocations(0);
+
+void* operator new(std::size_t size)
+{
+	g_allocations++;
+	void* p = std::malloc(size ? size : 1);
+	if (p == NULL) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void* operator new[](std::size_t size)
+{
+	return ::operator new(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	g_allocations++;
+	return std::malloc(size ? size : 1);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+	return ::operator new(size, std::nothrow);
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept
+{
+	std::free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept
+{
+	std::free(p);
+}
+
+using boost::asio::ip::tcp;
+
+namespace {
+
+	const size_t frame_size = 16;
+
+	// a client writing a frame in two pieces and reading the echo back, a server echoing
+	// it, and a timer that keeps re-arming itself alongside.
+	class echo_loop
+	{
+	public:
+		echo_loop(boost::asio::io_service& io, tcp::socket& client, tcp::socket& server)
+			:m_client(client)
+			,m_server(server)
+			,m_timer(io)
+			,m_rounds(0)
+			,m_received(0)
+			,m_done(true)
+		{
+			for (size_t i = 0; i < frame_size; i++) {
+				m_frame[i] = (uint8_t)i;
+			}
+			m_gather[0] = boost::asio::buffer(m_frame, 4);
+			m_gather[1] = boost::asio::buffer(m_frame + 4, frame_size - 4);
+		}
+
+		void start()
+		{
+			start_server_read();
+			start_timer();
+		}
+
+		// run until rounds more echoes came back.
+		void run(boost::asio::io_service& io, size_t rounds)
+		{
+			m_rounds = rounds;
+			m_done = false;
+			start_round();
+			while (!m_done) {
+				io.run_one();
+			}
+		}
+
+		void stop()
+		{
+			m_timer.cancel();
+		}
+
+		net::handler_memory& server_read_memory() { return m_server_read; }
+
+	private:
+		void start_round()
+		{
+			m_received = 0;
+			boost::asio::async_write(m_client, m_gather,
+				net::make_custom_alloc_handler(m_client_write,
+					boost::bind(&echo_loop::handle_client_write, this, boost::asio::placeholders::error)));
+			start_client_read();
+		}
+
+		void start_client_read()
+		{
+			m_client.async_read_some(boost::asio::buffer(m_echo + m_received, frame_size - m_received),
+				net::make_custom_alloc_handler(m_client_read,
+					boost::bind(&echo_loop::handle_client_read, this,
+						boost::asio::placeholders::error,
+						boost::asio::placeholders::bytes_transferred)));
+		}
+
+		void handle_client_write(const boost::system::error_code& ec)
+		{
+			CHECK(!ec);
+		}
+
+		void handle_client_read(const boost::system::error_code& ec, size_t bytes_transferred)
+		{
+			CHECK(!ec);
+			if (ec) {
+				m_done = true;
+				return;
+			}
+
+			m_received += bytes_transferred;
+			if (m_received < frame_size) {
+				start_client_read();
+				return;
+			}
+
+			if (--m_rounds == 0) {
+				m_done = true;
+				return;
+			}
+			start_round();
+		}
+
+		void start_server_read()
+		{
+			boost::asio::async_read(m_server, boost::asio::buffer(m_request),
+				net::make_custom_alloc_handler(m_server_read,
+					boost::bind(&echo_loop::handle_server_read, this, boost::asio::placeholders::error)));
+		}
+
+		void handle_server_read(const boost::system::error_code& ec)
+		{
+			if (ec) {
+				return;
+			}
+			boost::asio::async_write(m_server, boost::asio::buffer(m_request),
+				net::make_custom_alloc_handler(m_server_write,
+					boost::bind(&echo_loop::handle_server_write, this, boost::asio::placeholders::error)));
+		}
+
+		void handle_server_write(const boost::system::error_code& ec)
+		{
+			if (ec) {
+				return;
+			}
+			start_server_read();
+		}
+
+		void start_timer()
+		{
+			// re-armed only once the last wait completed, as the session tick does.
+			m_timer.expires_from_now(boost::posix_time::microseconds(50));
+			m_timer.async_wait(net::make_custom_alloc_handler(m_timer_memory,
+				boost::bind(&echo_loop::handle_timer, this, boost::asio::placeholders::error)));
+		}
+
+		void handle_timer(const boost::system::error_code& ec)
+		{
+			if (ec) {
+				return;
+			}
+			start_timer();
+		}
+
+	private:
+		tcp::socket& m_client;
+		tcp::socket& m_server;
+		boost::asio::deadline_timer m_timer;
+
+		net::handler_memory m_client_read;
+		net::handler_memory m_client_write;
+		net::handler_memory m_server_read;
+		net::handler_memory m_server_write;
+		net::handler_memory m_timer_memory;
+
+		uint8_t m_frame[frame_size];
+		std::array<boost::asio::const_buffer, 2> m_gather;
+		uint8_t m_echo[frame_size];
+		uint8_t m_request[frame_size];
+
+		size_t m_rounds;
+		size_t m_received;
+		bool m_done;
+	};
+}
+
+static void test_handler_memory_fallback()
+{
+	net::handler_memory memory;
+
+	size_t before = g_allocations;
+	void* block = memory.allocate(64);
+	CHECK_EQ(g_allocations - before, 0);
+
+	// busy: the second one comes from the heap.
+	void* spill = memory.allocate(64);
+	CHECK_EQ(g_allocations - before, 1);
+	CHECK(spill != block);
+	memory.deallocate(spill);
+
+	// too large for the block.
+	memory.deallocate(block);
+	void* large = memory.allocate(4096);
+	CHECK_EQ(g_allocations - before, 2);
+	memory.deallocate(large);
+
+	block = memory.allocate(64);
+	CHECK_EQ(g_allocations - before, 2);
+	memory.deallocate(block);
+}
+
+static void test_echo_round_trips(size_t rounds)
+{
+	boost::asio::io_service io;
+	tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	tcp::socket client(io);
+	tcp::socket server(io);
+	client.connect(acceptor.local_endpoint());
+	acceptor.accept(server);
+	client.set_option(tcp::no_delay(true));
+	server.set_option(tcp::no_delay(true));
+
+	echo_loop loop(io, client, server);
+	loop.start();
+
+	// the reactor's per-descriptor state, the timer queue and so on are set up on first use.
+	loop.run(io, 1000);
+
+	size_t before = g_allocations;
+	loop.run(io, rounds);
+	size_t allocations = g_allocations - before;
+	std::printf("%zu round trips, %zu operator new calls\n", rounds, allocations);
+	CHECK_EQ(allocations, 0);
+
+	// the server's read is pending and occupies its block, so anything else spills.
+	before = g_allocations;
+	void* probe = loop.server_read_memory().allocate(1);
+	CHECK_EQ(g_allocations - before, 1);
+	loop.server_read_memory().deallocate(probe);
+
+	loop.stop();
+	client.close();
+	server.close();
+	io.run();
+}
+
+int main(int argc, char* argv[])
+{
+	size_t rounds = argc > 1 ? std::strtoul(argv[1], NULL, 10) : 1000000;
+
+	test_handler_memory_fallback();
+	test_echo_round_trips(rounds);
+
+	return test_result("test_handler_memory");
+}
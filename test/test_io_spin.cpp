@@ -0,0 +1,204 @@
+// What io_options.spin_us trades: a spinning io thread burns the cpu while it waits for
+// the next completion, a blocking one does not, and a spin that outlasts the wait never
+// falls back to blocking. Round trip times are printed for comparison; on a machine
+// without a spare core the spinner takes cpu from the peer, so they are not checked.
+// io_sleeps only counts a spin that gave up, a thread that never spins shows none.
+
+#include "../src/tcp/tcp_session.h"
+#include "../src/tcp/tcp_session_data.h"
+#include "../src/tcp/tcp_client_data.h"
+#include "test_util.h"
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+using boost::asio::ip::tcp;
+
+namespace {
+
+	typedef std::chrono::steady_clock test_clock;
+
+	const int round_trips = 200;
+
+	// echoes whatever it reads, on its own thread.
+	class echo_peer
+	{
+	public:
+		echo_peer()
+			:m_acceptor(m_io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+			,m_socket(m_io)
+		{
+			m_thread = boost::thread(boost::bind(&echo_peer::run, this));
+		}
+
+		~echo_peer()
+		{
+			m_thread.join();
+		}
+
+		uint16_t port() const { return m_acceptor.local_endpoint().port(); }
+
+	private:
+		void run()
+		{
+			boost::system::error_code ec;
+			m_acceptor.accept(m_socket, ec);
+			char data[256];
+			while (!ec) {
+				size_t n = m_socket.read_some(boost::asio::buffer(data), ec);
+				if (!ec) {
+					boost::asio::write(m_socket, boost::asio::buffer(data, n), ec);
+				}
+			}
+		}
+
+	private:
+		boost::asio::io_service m_io;
+		tcp::acceptor m_acceptor;
+		tcp::socket m_socket;
+		boost::thread m_thread;
+	};
+
+	// the frames the io thread handed over, for a waiting main thread.
+	struct replies {
+		boost::mutex mutex;
+		boost::condition_variable arrived;
+		int count;
+		bool connected;
+		bool closed;
+
+		replies() : count(0), connected(false), closed(false) {}
+
+		void add()
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			count++;
+			arrived.notify_all();
+		}
+
+		void set(bool& flag)
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			flag = true;
+			arrived.notify_all();
+		}
+
+		// waits up to five seconds for pred.
+		template <typename Pred> bool wait(Pred pred)
+		{
+			boost::mutex::scoped_lock lock(mutex);
+			boost::system_time until = boost::get_system_time() + boost::posix_time::seconds(5);
+			while (!pred()) {
+				if (!arrived.timed_wait(lock, until)) {
+					return pred();
+				}
+			}
+			return true;
+		}
+	};
+
+	double cpu_seconds()
+	{
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec
+			+ (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+	}
+
+	struct result {
+		double median_rtt_us;
+		uint64_t sleeps;         // times the io thread blocked over the round trips
+		double idle_cpu_share;   // of the idle window after them, process wide
+		uint64_t idle_sleeps;    // times the io thread blocked during it
+	};
+
+	// round trips with a short pause between them, then an idle window.
+	result measure(uint32_t spin_us)
+	{
+		echo_peer peer;
+		replies seen;
+
+		net::tcp_session::io_options io;
+		io.spin_us = spin_us;
+
+		net::tcp_session::ptr session(new net::tcp_session());
+		session->data()
+			.host("127.0.0.1")
+			.port(peer.port())
+			.heartbeat_interval(0)
+			.header_length(4)
+			.read_skip_length(4)
+			.io_options(io)
+			.on_connected_handler([&seen](std::string) { seen.set(seen.connected); })
+			.on_frame_handler([&seen](const uint8_t*, uint32_t) { seen.add(); })
+			.on_closed_handler([&seen]() { seen.set(seen.closed); })
+			;
+		session->connect();
+		CHECK(seen.wait([&seen]() { return seen.connected; }));
+
+		net::tcp_session::buffer_ptr frame = net::tcp_client_data::frame_raw("ping", 4, false);
+		std::vector<double> rtts;
+		for (int i = 0; i < round_trips; i++) {
+			test_clock::time_point start = test_clock::now();
+			session->send(frame);
+			bool answered = seen.wait([&seen, i]() { return seen.count > i; });
+			CHECK(answered);
+			if (!answered) {
+				break;
+			}
+			rtts.push_back(std::chrono::duration<double, std::micro>(test_clock::now() - start).count());
+			boost::this_thread::sleep(boost::posix_time::microseconds(200));
+		}
+		std::sort(rtts.begin(), rtts.end());
+
+		result r;
+		r.median_rtt_us = rtts.empty() ? 0 : rtts[rtts.size() / 2];
+		r.sleeps = session->io_sleeps();
+
+		// nothing to do for half a second.
+		uint64_t sleeps = session->io_sleeps();
+		double cpu = cpu_seconds();
+		test_clock::time_point start = test_clock::now();
+		boost::this_thread::sleep(boost::posix_time::milliseconds(500));
+		double wall = std::chrono::duration<double>(test_clock::now() - start).count();
+		r.idle_cpu_share = (cpu_seconds() - cpu) / wall;
+		r.idle_sleeps = session->io_sleeps() - sleeps;
+
+		session->close();
+		CHECK(seen.wait([&seen]() { return seen.closed; }));
+		session->wait_io_threads();
+		return r;
+	}
+}
+
+int main()
+{
+	// blocking at once; a spin shorter than the pauses; one longer than the idle window.
+	result blocking = measure(0);
+	result short_spin = measure(50);
+	result long_spin = measure(2000000);
+
+	const result* results[] = { &blocking, &short_spin, &long_spin };
+	const char* names[] = { "0", "50", "2000000" };
+	std::printf("spin us   median rtt us  sleeps  idle cpu  idle sleeps\n");
+	for (int i = 0; i < 3; i++) {
+		std::printf("%-9s %13.1f %7llu  %7.0f%%  %11llu\n", names[i], results[i]->median_rtt_us,
+			(unsigned long long)results[i]->sleeps, results[i]->idle_cpu_share * 100,
+			(unsigned long long)results[i]->idle_sleeps);
+	}
+
+	// the short spin gives up in most 200us pauses and blocks, the long one never does.
+	// Idle, the first two cost nothing, the long spinner keeps a core busy throughout.
+	CHECK(short_spin.sleeps >= round_trips / 2);
+	CHECK_EQ(long_spin.sleeps, 0);
+	CHECK_EQ(long_spin.idle_sleeps, 0);
+	CHECK(blocking.idle_cpu_share < 0.2);
+	CHECK(short_spin.idle_cpu_share < 0.2);
+	CHECK(long_spin.idle_cpu_share > 0.8);
+
+	return test_result("test_io_spin");
+}
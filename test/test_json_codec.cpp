@@ -0,0 +1,120 @@
+// json_codec::decode accepts what RFC 8259 calls JSON and nothing else; strings are
+// checked at every offset, so both the 16-byte scan and the byte loop after it are hit.
+
+#include "../src/codec/json_codec.h"
+#include "test_util.h"
+#include <cstring>
+#include <string>
+
+static lua_State* L;
+
+static bool decode(const std::string& doc, std::string* error = NULL)
+{
+	std::string e;
+	int top = lua_gettop(L);
+	bool ok = net::json_codec::decode(L, (const uint8_t*)doc.data(), (uint32_t)doc.size(), e);
+	CHECK_EQ(lua_gettop(L), top + (ok ? 1 : 0));
+	if (error) {
+		*error = e;
+	}
+	return ok;
+}
+
+static void check_rejected(const std::string& doc, const char* reason)
+{
+	std::string error;
+	bool ok = decode(doc, &error);
+	if (ok) {
+		std::fprintf(stderr, "accepted: %s\n", doc.c_str());
+		lua_pop(L, 1);
+	}
+	CHECK(!ok);
+	CHECK(error.find(reason) != std::string::npos);
+}
+
+static void test_numbers()
+{
+	const char* valid[] = { "0", "-0", "0.5", "-0.5", "10", "1e5", "1E+2", "2.5e-3", "-0.0e-1", "[0,1,-0]" };
+	for (size_t i = 0; i < sizeof(valid) / sizeof(valid[0]); i++) {
+		CHECK(decode(valid[i]));
+		lua_pop(L, 1);
+	}
+
+	check_rejected("01", "leading zero");
+	check_rejected("-01", "leading zero");
+	check_rejected("00", "leading zero");
+	check_rejected("[1,023]", "leading zero");
+	check_rejected("1e", "no digits in exponent");
+	check_rejected("1E+", "no digits in exponent");
+	check_rejected("[2e-]", "no digits in exponent");
+	check_rejected("1.", "no digits after decimal point");
+	check_rejected("1.e5", "no digits after decimal point");
+	check_rejected("-", "invalid number");
+	check_rejected(".5", "invalid number");
+	check_rejected("+1", "invalid number");
+}
+
+static void test_strings()
+{
+	for (size_t len = 0; len < 40; len++) {
+		std::string body(len, 'a');
+		std::string doc = "\"" + body + "\"";
+		CHECK(decode(doc));
+		size_t got = 0;
+		lua_tolstring(L, -1, &got);
+		CHECK_EQ(got, len);
+		lua_pop(L, 1);
+
+		// a raw control character at every offset, with and without an escape before it.
+		for (size_t at = 0; at < len; at++) {
+			std::string bad = body;
+			bad[at] = (char)(at % 0x20);
+			check_rejected("\"" + bad + "\"", "control character");
+			check_rejected("\"\\n" + bad + "\"", "control character");
+		}
+	}
+
+	check_rejected(std::string("\"\0\"", 3), "control character");
+	check_rejected("{\"a\tb\":1}", "control character");
+	check_rejected("\"\x7f\x1f\"", "control character");
+
+	// escaped, they are fine; DEL and bytes above it need no escaping.
+	CHECK(decode("\"\\t\\n\\u0001\x7f\xc3\xa9\""));
+	size_t len = 0;
+	const char* s = lua_tolstring(L, -1, &len);
+	CHECK_EQ(len, 6);
+	CHECK(std::memcmp(s, "\t\n\x01\x7f\xc3\xa9", 6) == 0);
+	lua_pop(L, 1);
+}
+
+static void test_round_trip()
+{
+	const char* doc = "{\"id\":7,\"cmd\":\"move\",\"args\":[1,-2.5,\"p\\\"1\\\"\",true,{}],\"none\":null}";
+	CHECK(decode(doc));
+
+	byte_buffer out(64);
+	out.clear();
+	std::string error;
+	CHECK(net::json_codec::encode(L, -1, out, error));
+	lua_pop(L, 1);
+
+	std::string encoded((const char*)out.data(), out.size());
+	CHECK(decode(encoded));
+	lua_getfield(L, -1, "args");
+	CHECK_EQ(lua_rawlen(L, -1), 5);
+	lua_rawgeti(L, -1, 3);
+	CHECK(lua_isstring(L, -1) && std::strcmp(lua_tostring(L, -1), "p\"1\"") == 0);
+	lua_pop(L, 3);
+}
+
+int main()
+{
+	L = luaL_newstate();
+
+	test_numbers();
+	test_strings();
+	test_round_trip();
+
+	lua_close(L);
+	return test_result("test_json_codec");
+}
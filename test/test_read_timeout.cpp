@@ -0,0 +1,174 @@
+// A session whose peer stays silent for read_timeout seconds is closed by its tick; one
+// whose peer keeps sending is not. The peer is a loopback acceptor on its own thread.
+
+#include "../src/tcp/tcp_session.h"
+#include "../src/tcp/tcp_session_data.h"
+#include "../src/tcp/tcp_client_data.h"
+#include "test_util.h"
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+using boost::asio::ip::tcp;
+
+namespace {
+
+	typedef std::chrono::steady_clock test_clock;
+
+	// accepts one connection, then either says nothing or writes a frame every interval.
+	class peer
+	{
+	public:
+		explicit peer(long interval_ms)
+			:m_acceptor(m_io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0))
+			,m_socket(m_io)
+			,m_timer(m_io)
+			,m_interval_ms(interval_ms)
+			,m_frame(net::tcp_client_data::frame_raw("tick", 4, false))
+		{
+			m_acceptor.async_accept(m_socket, boost::bind(&peer::handle_accept, this, boost::asio::placeholders::error));
+			m_thread = boost::thread(boost::bind(&boost::asio::io_service::run, &m_io));
+		}
+
+		~peer()
+		{
+			m_io.stop();
+			m_thread.join();
+		}
+
+		uint16_t port() const { return m_acceptor.local_endpoint().port(); }
+
+	private:
+		void handle_accept(const boost::system::error_code& ec)
+		{
+			if (!ec && m_interval_ms > 0) {
+				start_timer();
+			}
+		}
+
+		void start_timer()
+		{
+			m_timer.expires_from_now(boost::posix_time::milliseconds(m_interval_ms));
+			m_timer.async_wait(boost::bind(&peer::handle_timer, this, boost::asio::placeholders::error));
+		}
+
+		void handle_timer(const boost::system::error_code& ec)
+		{
+			if (ec) {
+				return;
+			}
+			boost::system::error_code write_ec;
+			boost::asio::write(m_socket, boost::asio::buffer(m_frame->getRawBuf()), write_ec);
+			if (!write_ec) {
+				start_timer();
+			}
+		}
+
+	private:
+		boost::asio::io_service m_io;
+		tcp::acceptor m_acceptor;
+		tcp::socket m_socket;
+		boost::asio::deadline_timer m_timer;
+		long m_interval_ms;
+		net::tcp_session::buffer_ptr m_frame;
+		boost::thread m_thread;
+	};
+
+	struct observed {
+		std::atomic<bool> connected;
+		std::atomic<bool> closed;
+		std::atomic<int> frames;
+		std::atomic<bool> timed_out;
+		test_clock::time_point connected_at;
+		test_clock::time_point closed_at;
+
+		observed() : connected(false), closed(false), frames(0), timed_out(false) {}
+	};
+
+	net::tcp_session::ptr connect(uint16_t port, uint32_t read_timeout, observed& seen)
+	{
+		net::tcp_session::ptr session(new net::tcp_session());
+		session->data()
+			.host("127.0.0.1")
+			.port(port)
+			.connect_timeout(5)
+			.read_timeout(read_timeout)
+			.heartbeat_interval(0)
+			.magic_key(0)
+			.header_length(4)
+			.read_skip_length(4)
+			.on_connected_handler([&seen](std::string) {
+				seen.connected_at = test_clock::now();
+				seen.connected = true;
+			})
+			.on_frame_handler([&seen](const uint8_t*, uint32_t) { seen.frames++; })
+			.on_error_handler([&seen](std::string error) {
+				if (error.find("connection timeout") != std::string::npos) {
+					seen.timed_out = true;
+				}
+			})
+			.on_closed_handler([&seen]() {
+				seen.closed_at = test_clock::now();
+				seen.closed = true;
+			})
+			;
+		session->connect();
+		return session;
+	}
+
+	// polls flag for up to seconds.
+	bool wait_until_set(const std::atomic<bool>& flag, double seconds)
+	{
+		test_clock::time_point until = test_clock::now() + std::chrono::milliseconds((long)(seconds * 1000));
+		while (!flag && test_clock::now() < until) {
+			boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+		}
+		return flag;
+	}
+}
+
+static void test_silent_peer_is_closed()
+{
+	peer silent(0);
+	observed seen;
+	net::tcp_session::ptr session = connect(silent.port(), 2, seen);
+
+	CHECK(wait_until_set(seen.connected, 5));
+	CHECK(wait_until_set(seen.closed, 6));
+	CHECK(seen.timed_out);
+
+	if (seen.closed) {
+		// the tick runs once a second, so somewhere between one and three of them.
+		double after = std::chrono::duration<double>(seen.closed_at - seen.connected_at).count();
+		std::printf("silent peer closed after %.2f s with read_timeout 2\n", after);
+		CHECK(after >= 1.0 && after <= 3.5);
+	}
+
+	session->wait_io_threads();
+}
+
+static void test_talking_peer_stays_open()
+{
+	peer talking(400);
+	observed seen;
+	net::tcp_session::ptr session = connect(talking.port(), 2, seen);
+
+	CHECK(wait_until_set(seen.connected, 5));
+	CHECK(!wait_until_set(seen.closed, 4.5));
+	CHECK(!seen.timed_out);
+	CHECK(seen.frames >= 5);
+
+	session->close();
+	CHECK(wait_until_set(seen.closed, 5));
+	session->wait_io_threads();
+}
+
+int main()
+{
+	test_silent_peer_is_closed();
+	test_talking_peer_stays_open();
+
+	return test_result("test_read_timeout");
+}
@@ -0,0 +1,187 @@
+// rpc_table's window: at most window calls on the wire, the rest queued in order with
+// their frames and released as answers come back or queued calls time out.
+
+#include "../src/tcp/rpc_table.h"
+#include "test_util.h"
+#include <vector>
+
+using net::rpc_table;
+
+static rpc_table::frame_ptr make_frame(uint32_t id)
+{
+	rpc_table::frame_ptr frame(new byte_buffer(4));
+	frame->putInt(id);
+	return frame;
+}
+
+static uint32_t frame_id(const rpc_table::frame_ptr& frame)
+{
+	return frame->getInt(0);
+}
+
+// admits a call with its own frame, the return of admit.
+static bool admit(rpc_table& table, uint32_t id, boost::posix_time::ptime deadline = boost::posix_time::not_a_date_time)
+{
+	rpc_table::call c;
+	c.id = id;
+	c.ref = (int)id;
+	c.coroutine = false;
+	c.thread = NULL;
+	c.sent = false;
+	c.deadline = deadline;
+	return table.admit(c, make_frame(id));
+}
+
+static bool answer(rpc_table& table, uint32_t id)
+{
+	rpc_table::call c;
+	return table.take(id, c);
+}
+
+static void test_window_queue()
+{
+	rpc_table table;
+	table.set_window(3);
+
+	for (uint32_t id = 1; id <= 3; id++) {
+		CHECK(admit(table, id));
+	}
+	for (uint32_t id = 4; id <= 8; id++) {
+		CHECK(!admit(table, id));
+	}
+	CHECK_EQ(table.in_flight(), 3);
+	CHECK_EQ(table.queued(), 5);
+	CHECK_EQ(table.size(), 8);
+
+	// nothing fits until an answer comes back.
+	std::vector<rpc_table::frame_ptr> out;
+	table.take_sendable(out);
+	CHECK_EQ(out.size(), 0);
+
+	CHECK(answer(table, 2));
+	CHECK(!answer(table, 2));
+	table.take_sendable(out);
+	CHECK_EQ(out.size(), 1);
+	CHECK_EQ(frame_id(out[0]), 4);
+	CHECK_EQ(table.in_flight(), 3);
+
+	// two answers, two frames, oldest first.
+	out.clear();
+	CHECK(answer(table, 1));
+	CHECK(answer(table, 3));
+	table.take_sendable(out);
+	CHECK_EQ(out.size(), 2);
+	CHECK_EQ(frame_id(out[0]), 5);
+	CHECK_EQ(frame_id(out[1]), 6);
+
+	// a new call goes behind the queue, not past it, even with the window open.
+	out.clear();
+	CHECK(answer(table, 4));
+	CHECK(!admit(table, 9));
+	table.take_sendable(out);
+	CHECK_EQ(out.size(), 1);
+	CHECK_EQ(frame_id(out[0]), 7);
+
+	// a queued call answered (or dropped) before its turn never goes out.
+	out.clear();
+	CHECK(answer(table, 8));
+	CHECK(answer(table, 5));
+	table.take_sendable(out);
+	CHECK_EQ(out.size(), 1);
+	CHECK_EQ(frame_id(out[0]), 9);
+	CHECK_EQ(table.queued(), 0);
+	CHECK_EQ(table.in_flight(), 3);
+}
+
+static void test_queued_calls_expire()
+{
+	boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+	boost::posix_time::ptime soon = now + boost::posix_time::seconds(1);
+	boost::posix_time::ptime later = now + boost::posix_time::seconds(10);
+
+	rpc_table table;
+	table.set_window(1);
+
+	CHECK(admit(table, 1, later));
+	CHECK(!admit(table, 2, soon));
+	CHECK(!admit(table, 3, later));
+	CHECK(table.next_deadline() == soon);
+
+	// the queued call 2 times out without ever being sent.
+	std::vector<rpc_table::call> expired;
+	table.expire(soon, expired);
+	CHECK_EQ(expired.size(), 1);
+	CHECK_EQ(expired[0].id, 2);
+	CHECK(!expired[0].sent);
+	CHECK_EQ(table.in_flight(), 1);
+
+	// so 3 is next once 1 is answered.
+	std::vector<rpc_table::frame_ptr> out;
+	CHECK(answer(table, 1));
+	table.take_sendable(out);
+	CHECK_EQ(out.size(), 1);
+	CHECK_EQ(frame_id(out[0]), 3);
+
+	// a sent call that times out opens the window as an answer would.
+	CHECK(!admit(table, 4));
+	expired.clear();
+	table.expire(later, expired);
+	CHECK_EQ(expired.size(), 1);
+	CHECK_EQ(expired[0].id, 3);
+	CHECK(expired[0].sent);
+	out.clear();
+	table.take_sendable(out);
+	CHECK_EQ(out.size(), 1);
+	CHECK_EQ(frame_id(out[0]), 4);
+}
+
+static void test_window_changes()
+{
+	rpc_table table;
+
+	// no window: everything goes out at once.
+	for (uint32_t id = 1; id <= 100; id++) {
+		CHECK(admit(table, id));
+	}
+	CHECK_EQ(table.in_flight(), 100);
+
+	// a window below what is in flight holds new calls until enough answers came back.
+	table.set_window(10);
+	CHECK(!admit(table, 101));
+	std::vector<rpc_table::frame_ptr> out;
+	for (uint32_t id = 1; id <= 90; id++) {
+		CHECK(answer(table, id));
+		table.take_sendable(out);
+		CHECK_EQ(out.size(), 0);
+	}
+	CHECK(answer(table, 91));
+	table.take_sendable(out);
+	CHECK_EQ(out.size(), 1);
+
+	// widening it lets the queue out right away.
+	for (uint32_t id = 102; id <= 110; id++) {
+		CHECK(!admit(table, id));
+	}
+	out.clear();
+	table.set_window(20);
+	table.take_sendable(out);
+	CHECK_EQ(out.size(), 9);
+	CHECK_EQ(table.in_flight(), 19);
+
+	// take_all leaves nothing queued or in flight.
+	std::vector<rpc_table::call> all;
+	table.take_all(all);
+	CHECK_EQ(all.size(), 19);
+	CHECK_EQ(table.in_flight(), 0);
+	CHECK_EQ(table.queued(), 0);
+	CHECK(admit(table, 111));
+}
+
+int main()
+{
+	test_window_queue();
+	test_queued_calls_expire();
+	test_window_changes();
+
+	return test_result("test_rpc_window");
+}
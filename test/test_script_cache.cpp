@@ -0,0 +1,163 @@
+// The bytecode cache: a file found under a script's hash is only used if it was
+// compiled from that very script.
+
+#include "../src/lua_script_cache.h"
+#include "../src/sha256.h"
+#include "test_util.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::string hex(const uint8_t* p, size_t n)
+{
+	static const char digits[] = "0123456789abcdef";
+	std::string out;
+	for (size_t i = 0; i < n; i++) {
+		out.push_back(digits[p[i] >> 4]);
+		out.push_back(digits[p[i] & 0xF]);
+	}
+	return out;
+}
+
+static std::string sha256_hex(const std::string& data, size_t piece)
+{
+	sha256_state s;
+	sha256_init(&s);
+	for (size_t i = 0; i < data.size(); i += piece) {
+		sha256_update(&s, data.data() + i, std::min(piece, data.size() - i));
+	}
+	uint8_t digest[sha256_digest_size];
+	sha256_final(&s, digest);
+	return hex(digest, sizeof(digest));
+}
+
+static void test_sha256()
+{
+	// FIPS 180-4 examples.
+	CHECK(sha256_hex("", 1) == "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+	CHECK(sha256_hex("abc", 1) == "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+	CHECK(sha256_hex("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq", 64)
+		== "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+	std::string million(1000000, 'a');
+	std::string expected = "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0";
+	CHECK(sha256_hex(million, million.size()) == expected);
+	CHECK(sha256_hex(million, 1) == expected);
+	CHECK(sha256_hex(million, 63) == expected);
+	CHECK(sha256_hex(million, 65) == expected);
+}
+
+static void write_file(const std::string& path, const std::string& content)
+{
+	std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+	out << content;
+}
+
+static std::string read_file(const std::string& path)
+{
+	std::ifstream in(path.c_str(), std::ios::binary);
+	std::ostringstream os;
+	os << in.rdbuf();
+	return os.str();
+}
+
+// the one cache file in dir.
+static std::string cache_file(const std::string& dir)
+{
+	std::string found;
+	DIR* d = opendir(dir.c_str());
+	if (d == NULL) {
+		return found;
+	}
+	while (struct dirent* e = readdir(d)) {
+		std::string name = e->d_name;
+		if (name.size() > 5 && name.compare(name.size() - 5, 5, ".luac") == 0) {
+			CHECK(found.empty());
+			found = dir + "/" + name;
+		}
+	}
+	closedir(d);
+	return found;
+}
+
+// runs script through the cache, the integer it returns or -1.
+static lua_Integer run(const std::string& script, const std::string& cache_dir)
+{
+	lua_State* L = luaL_newstate();
+	luaL_openlibs(L);
+
+	lua_Integer result = -1;
+	if (luacache_dofile(L, script.c_str(), cache_dir.c_str()) == LUA_OK) {
+		result = lua_isinteger(L, -1) ? lua_tointeger(L, -1) : -1;
+	}
+	else {
+		std::fprintf(stderr, "%s\n", lua_tostring(L, -1));
+	}
+	lua_close(L);
+	return result;
+}
+
+static void test_cache(const std::string& root)
+{
+	std::string dir_a = root + "/a";
+	std::string dir_b = root + "/b";
+	CHECK(mkdir(dir_a.c_str(), 0700) == 0);
+	CHECK(mkdir(dir_b.c_str(), 0700) == 0);
+
+	std::string script = root + "/script.lua";
+	write_file(script, "return 40 + 2\n");
+
+	CHECK_EQ(run(script, dir_a), 42);
+	std::string entry = cache_file(dir_a);
+	CHECK(!entry.empty());
+	std::string compiled = read_file(entry);
+	CHECK(compiled.compare(0, 4, "LCC1") == 0);
+
+	// from the cache this time.
+	CHECK_EQ(run(script, dir_a), 42);
+
+	// another script's bytecode under this script's name, as after a hash collision.
+	std::string other = root + "/other.lua";
+	write_file(other, "return 7\n");
+	CHECK_EQ(run(other, dir_b), 7);
+	write_file(entry, read_file(cache_file(dir_b)));
+
+	CHECK_EQ(run(script, dir_a), 42);
+	CHECK(read_file(entry) == compiled);
+
+	// bytecode without a header, as left by an older build.
+	write_file(entry, compiled.substr(4 + 8 + sha256_digest_size));
+	CHECK_EQ(run(script, dir_a), 42);
+	CHECK(read_file(entry) == compiled);
+
+	// an edited script gets an entry of its own.
+	write_file(script, "return 40 + 3\n");
+	CHECK_EQ(run(script, dir_a), 43);
+
+	// an empty file can not be mapped, but is a valid script.
+	std::string empty = root + "/empty.lua";
+	write_file(empty, "");
+	lua_State* L = luaL_newstate();
+	CHECK_EQ(luacache_dofile(L, empty.c_str(), dir_a.c_str()), LUA_OK);
+	lua_close(L);
+
+	std::string cleanup = "rm -rf '" + root + "'";
+	CHECK(std::system(cleanup.c_str()) == 0);
+}
+
+int main()
+{
+	test_sha256();
+
+	char root[] = "/tmp/test_script_cache.XXXXXX";
+	CHECK(mkdtemp(root) != NULL);
+	test_cache(root);
+
+	return test_result("test_script_cache");
+}
@@ -0,0 +1,155 @@
+// Options given in socket_options are on the connected socket, as getsockopt sees them,
+// and applied_socket_options reports what the kernel settled on. Linux doubles buffer
+// sizes it is given and reports the doubled value; asio halves it back when reading.
+
+#include "../src/tcp/tcp_session.h"
+#include "../src/tcp/tcp_session_data.h"
+#include "test_util.h"
+#include <boost/thread.hpp>
+#include <atomic>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+
+using boost::asio::ip::tcp;
+
+namespace {
+
+	struct observed {
+		std::atomic<bool> connected;
+		std::atomic<bool> closed;
+		std::atomic<bool> busy_poll_refused;
+
+		observed() : connected(false), closed(false), busy_poll_refused(false) {}
+	};
+
+	bool wait_until_set(const std::atomic<bool>& flag)
+	{
+		for (int i = 0; i < 500 && !flag; i++) {
+			boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+		}
+		return flag;
+	}
+
+	int get_int_option(int fd, int level, int name)
+	{
+		int value = -1;
+		socklen_t len = sizeof(value);
+		if (getsockopt(fd, level, name, &value, &len) != 0) {
+			return -1;
+		}
+		return value;
+	}
+
+	// connects to the listening acceptor, which never accepts: the kernel completes the
+	// handshake from its backlog, which is all the options need.
+	net::tcp_session::ptr connect(uint16_t port, const net::tcp_session::socket_options& options, observed& seen)
+	{
+		net::tcp_session::ptr session(new net::tcp_session());
+		session->data()
+			.host("127.0.0.1")
+			.port(port)
+			.heartbeat_interval(0)
+			.header_length(4)
+			.read_skip_length(4)
+			.socket_options(options)
+			.on_connected_handler([&seen](std::string) { seen.connected = true; })
+			.on_error_handler([&seen](std::string error) {
+				if (error.find("busy_poll") != std::string::npos) {
+					seen.busy_poll_refused = true;
+				}
+			})
+			.on_closed_handler([&seen]() { seen.closed = true; })
+			;
+		session->connect();
+		return session;
+	}
+
+	void close(const net::tcp_session::ptr& session, observed& seen)
+	{
+		session->close();
+		CHECK(wait_until_set(seen.closed));
+		session->wait_io_threads();
+	}
+}
+
+static void test_options_applied(tcp::acceptor& acceptor)
+{
+	net::tcp_session::socket_options want;
+	want.nodelay = true;
+	want.sndbuf = 96 * 1024;
+	want.rcvbuf = 48 * 1024;
+	want.busy_poll = 50;
+	want.quickack = true;
+
+	observed seen;
+	net::tcp_session::ptr session = connect(acceptor.local_endpoint().port(), want, seen);
+	CHECK(wait_until_set(seen.connected));
+
+	int fd = session->data().socket()->native_handle();
+	int nodelay = get_int_option(fd, IPPROTO_TCP, TCP_NODELAY);
+	int sndbuf = get_int_option(fd, SOL_SOCKET, SO_SNDBUF);
+	int rcvbuf = get_int_option(fd, SOL_SOCKET, SO_RCVBUF);
+	std::printf("nodelay %d, sndbuf %d, rcvbuf %d\n", nodelay, sndbuf, rcvbuf);
+
+	CHECK(nodelay != 0);
+	// Linux doubles what it is given for its own bookkeeping.
+	CHECK(sndbuf >= want.sndbuf && sndbuf <= 2 * want.sndbuf);
+	CHECK(rcvbuf >= want.rcvbuf && rcvbuf <= 2 * want.rcvbuf);
+
+	const net::tcp_session::socket_options& got = session->data().applied_socket_options();
+	CHECK(got.nodelay);
+#if defined(__linux__)
+	CHECK_EQ(got.sndbuf, sndbuf / 2);
+	CHECK_EQ(got.rcvbuf, rcvbuf / 2);
+#else
+	CHECK_EQ(got.sndbuf, sndbuf);
+	CHECK_EQ(got.rcvbuf, rcvbuf);
+#endif
+
+#if defined(SO_BUSY_POLL)
+	// raising it needs CAP_NET_ADMIN; without it the refusal is reported instead.
+	int busy_poll = get_int_option(fd, SOL_SOCKET, SO_BUSY_POLL);
+	std::printf("busy_poll %d%s\n", busy_poll, seen.busy_poll_refused ? " (refused)" : "");
+	CHECK(busy_poll == want.busy_poll || seen.busy_poll_refused);
+	CHECK_EQ(got.busy_poll, busy_poll);
+#endif
+#if defined(TCP_QUICKACK)
+	CHECK(got.quickack);
+#endif
+
+	close(session, seen);
+}
+
+static void test_defaults_left_alone(tcp::acceptor& acceptor)
+{
+	observed seen;
+	net::tcp_session::ptr session = connect(acceptor.local_endpoint().port(), net::tcp_session::socket_options(), seen);
+	CHECK(wait_until_set(seen.connected));
+
+	int fd = session->data().socket()->native_handle();
+	CHECK_EQ(get_int_option(fd, IPPROTO_TCP, TCP_NODELAY), 0);
+
+	// the system defaults, read when the socket was opened; the kernel tunes unlocked
+	// buffer sizes as the connection goes on, so they are not compared.
+	const net::tcp_session::socket_options& got = session->data().applied_socket_options();
+	CHECK(!got.nodelay);
+	CHECK(got.sndbuf > 0);
+	CHECK(got.rcvbuf > 0);
+	CHECK(!got.quickack);
+
+	close(session, seen);
+}
+
+int main()
+{
+	boost::asio::io_service io;
+	tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+	acceptor.listen(8);
+
+	test_options_applied(acceptor);
+	test_defaults_left_alone(acceptor);
+
+	return test_result("test_socket_options");
+}
@@ -0,0 +1,38 @@
+#ifndef __TEST_UTIL_H__
+#define __TEST_UTIL_H__
+
+#include <cstdio>
+
+// A failed CHECK is reported and counted, the test carries on; main returns test_result().
+static int test_failures = 0;
+
+#define CHECK(cond) \
+	do { \
+		if (!(cond)) { \
+			std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+			test_failures++; \
+		} \
+	} while (0)
+
+#define CHECK_EQ(a, b) \
+	do { \
+		long long check_a = (long long)(a); \
+		long long check_b = (long long)(b); \
+		if (check_a != check_b) { \
+			std::fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", \
+				__FILE__, __LINE__, #a, #b, check_a, check_b); \
+			test_failures++; \
+		} \
+	} while (0)
+
+static inline int test_result(const char* name)
+{
+	if (test_failures != 0) {
+		std::fprintf(stderr, "%s: %d check(s) failed\n", name, test_failures);
+		return 1;
+	}
+	std::printf("%s: ok\n", name);
+	return 0;
+}
+
+#endif // !__TEST_UTIL_H__